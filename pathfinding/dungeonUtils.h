@@ -1,6 +1,8 @@
 #pragma once
 #include "math.h"
 #include <cstddef>
+#include <cstdint>
+#include <array>
 
 namespace dungeon
 {
@@ -8,5 +10,31 @@ namespace dungeon
   constexpr char floor = ' ';
   constexpr char water = 'o';
 
+  constexpr uint8_t impassable = 0;
+
+  // Cost of stepping onto a tile, indexed by tile char. Tiles without an entry cost as much as floor.
+  // Walkable tiles cost at least 1, so distance heuristics never overestimate
+  constexpr std::array<uint8_t, 256> make_tile_costs()
+  {
+    std::array<uint8_t, 256> costs{};
+    for (uint8_t &cost : costs)
+      cost = 1;
+    costs[uint8_t(wall)] = impassable;
+    costs[uint8_t(water)] = 10;
+    return costs;
+  }
+
+  constexpr std::array<uint8_t, 256> tileCosts = make_tile_costs();
+
+  constexpr uint8_t tile_cost(char tile)
+  {
+    return tileCosts[uint8_t(tile)];
+  }
+
+  constexpr bool is_passable(char tile)
+  {
+    return tile_cost(tile) != impassable;
+  }
+
   Position find_walkable_tile(const char *dungeon, const size_t width, const size_t height);
 }
@@ -2,8 +2,11 @@
 #include <functional>
 #include <vector>
 #include <limits>
+#include <algorithm>
+#include <cstdint>
 #include <float.h>
 #include <cmath>
+#include <chrono>
 #include "math.h"
 #include "dungeonGen.h"
 #include "dungeonUtils.h"
@@ -36,15 +39,16 @@ static void draw_path(std::vector<Position> path)
   }
 }
 
-static std::vector<Position> reconstruct_path(std::vector<Position> prev, Position to, size_t width)
+static std::vector<Position> reconstruct_path(const std::vector<Position> &prev, Position to, size_t width)
 {
   Position curPos = to;
   std::vector<Position> res = {curPos};
   while (prev[coord_to_idx(curPos.x, curPos.y, width)] != Position{-1, -1})
   {
     curPos = prev[coord_to_idx(curPos.x, curPos.y, width)];
-    res.insert(res.begin(), curPos);
+    res.push_back(curPos);
   }
+  std::reverse(res.begin(), res.end());
   return res;
 }
 
@@ -53,83 +57,207 @@ float heuristic(Position lhs, Position rhs)
   return sqrtf(square(float(lhs.x - rhs.x)) + square(float(lhs.y - rhs.y)));
 };
 
-static float ida_star_search(const char *input, size_t width, size_t height, std::vector<Position> &path, const float g, const float bound, Position to)
+constexpr size_t IDA_STAR_TABLE_SIZE = 8192; // power of two
+constexpr size_t IDA_STAR_MAX_EXPANSIONS = 500000; // per search
+
+// Depth first searches with growing bound on f, a low memory alternative to A*. Memory taken is the current path,
+// a bit per cell telling if it's on the path and a fixed size table remembering the lowest g cells were reached with
+// during the current iteration, so cells reached again through longer detours aren't searched twice
+struct IdaStarContext
 {
-  const Position &p = path.back();
-  const float f = g + heuristic(p, to);
-  if (f > bound)
-    return f;
-  if (p == to)
-    return -f;
-  float min = FLT_MAX;
-  auto checkNeighbour = [&](Position p) -> float
-  {
-    // out of bounds
-    if (p.x < 0 || p.y < 0 || p.x >= int(width) || p.y >= int(height))
-      return 0.f;
-    size_t idx = coord_to_idx(p.x, p.y, width);
-    // not empty
-    if (input[idx] == '#')
-      return 0.f;
-    if (std::find(path.begin(), path.end(), p) != path.end())
-      return 0.f;
-    path.push_back(p);
-    float weight = input[idx] == 'o' ? 10.f : 1.f;
-    float gScore = g + 1.f * weight; // we're exactly 1 unit away
-    const float t = ida_star_search(input, width, height, path, gScore, bound, to);
-    if (t < 0.f)
-      return t;
-    if (t < min)
-      min = t;
-    path.pop_back();
-    return t;
+  struct Frame
+  {
+    Position pos;
+    float g;
+    int nextDir; // next neighbour to try, 0 until the cell is entered
+  };
+
+  struct TableEntry
+  {
+    uint32_t cell;
+    uint32_t iteration; // entries of older iterations are empty
+    float g;
   };
-  float lv = checkNeighbour({p.x + 1, p.y + 0});
-  if (lv < 0.f) return lv;
-  float rv = checkNeighbour({p.x - 1, p.y + 0});
-  if (rv < 0.f) return rv;
-  float tv = checkNeighbour({p.x + 0, p.y + 1});
-  if (tv < 0.f) return tv;
-  float bv = checkNeighbour({p.x + 0, p.y - 1});
-  if (bv < 0.f) return bv;
-  return min;
+
+  std::vector<Frame> stack;
+  std::vector<uint64_t> onPath;
+  std::vector<TableEntry> table = std::vector<TableEntry>(IDA_STAR_TABLE_SIZE, TableEntry{0, 0, 0.f});
+  uint32_t iteration = 0;
+  // result of the last search, kept until the map or end points change
+  std::vector<Position> path;
+  bool hasPath = false;
+
+  void invalidate_path() { hasPath = false; }
+
+  bool is_on_path(size_t idx) const { return (onPath[idx / 64] >> (idx % 64)) & 1; }
+  void set_on_path(size_t idx, bool on)
+  {
+    if (on)
+      onPath[idx / 64] |= uint64_t(1) << (idx % 64);
+    else
+      onPath[idx / 64] &= ~(uint64_t(1) << (idx % 64));
+  }
+
+  // False if the cell was already reached with g not worse during this iteration
+  bool visit(size_t idx, float g)
+  {
+    // neighbouring cells never share an entry, cells sharing one are far apart
+    TableEntry &entry = table[idx & (IDA_STAR_TABLE_SIZE - 1)];
+    if (entry.iteration == iteration && entry.cell == uint32_t(idx) && entry.g <= g)
+      return false;
+    entry = {uint32_t(idx), iteration, g};
+    return true;
+  }
+};
+
+static IdaStarContext ida_star_context;
+
+static float manhattan(Position lhs, Position rhs)
+{
+  return float(std::abs(lhs.x - rhs.x) + std::abs(lhs.y - rhs.y));
 }
 
-static std::vector<Position> find_ida_star_path(const char *input, size_t width, size_t height, Position from, Position to)
+// Bound only grows to the next f found past it, so f should take few distinct values. Manhattan distance is
+// exact in open space of a 4-connected grid and keeps f whole, with euclidean one every bound step is tiny.
+// Returns empty path if there's no path or it wasn't found within max_expansions
+static std::vector<Position> find_ida_star_path(IdaStarContext &ctx, const char *input, size_t width, size_t height,
+                                                Position from, Position to, size_t max_expansions)
 {
-  float bound = heuristic(from, to);
-  std::vector<Position> path = {from};
-  while (true)
-  {
-    const float t = ida_star_search(input, width, height, path, 0.f, bound, to);
-    if (t < 0.f)
-      return path;
-    if (t == FLT_MAX)
-      return {};
-    bound = t;
-    printf("new bound %0.1f\n", bound);
+  auto walkable = [&](Position p)
+  {
+    return p.x >= 0 && p.y >= 0 && p.x < int(width) && p.y < int(height) && dungeon::is_passable(input[coord_to_idx(p.x, p.y, width)]);
+  };
+  if (!walkable(from) || !walkable(to))
+    return {};
+  ctx.onPath.assign((width * height + 63) / 64, 0);
+  const Position dirs[4] = {{1, 0}, {-1, 0}, {0, 1}, {0, -1}};
+  size_t expansions = 0;
+  float bound = manhattan(from, to);
+  while (bound < FLT_MAX)
+  {
+    if (++ctx.iteration == 0) // wrapped around, old entries can't be trusted anymore
+    {
+      std::fill(ctx.table.begin(), ctx.table.end(), IdaStarContext::TableEntry{0, 0, 0.f});
+      ctx.iteration = 1;
+    }
+    float nextBound = FLT_MAX;
+    ctx.stack.clear();
+    ctx.stack.push_back({from, 0.f, 0});
+    ctx.set_on_path(coord_to_idx(from.x, from.y, width), true);
+    while (!ctx.stack.empty())
+    {
+      IdaStarContext::Frame &top = ctx.stack.back();
+      const size_t idx = coord_to_idx(top.pos.x, top.pos.y, width);
+      if (top.nextDir == 0)
+      {
+        const float f = top.g + manhattan(top.pos, to);
+        if (f > bound)
+        {
+          nextBound = std::min(nextBound, f);
+          ctx.set_on_path(idx, false);
+          ctx.stack.pop_back();
+          continue;
+        }
+        if (top.pos == to)
+        {
+          std::vector<Position> path;
+          path.reserve(ctx.stack.size());
+          for (const IdaStarContext::Frame &frame : ctx.stack)
+            path.push_back(frame.pos);
+          return path;
+        }
+        if (!ctx.visit(idx, top.g))
+        {
+          ctx.set_on_path(idx, false);
+          ctx.stack.pop_back();
+          continue;
+        }
+        if (++expansions > max_expansions)
+          return {};
+      }
+      if (top.nextDir == 4)
+      {
+        ctx.set_on_path(idx, false);
+        ctx.stack.pop_back();
+        continue;
+      }
+      const Position p{top.pos.x + dirs[top.nextDir].x, top.pos.y + dirs[top.nextDir].y};
+      ++top.nextDir;
+      if (!walkable(p))
+        continue;
+      const size_t nidx = coord_to_idx(p.x, p.y, width);
+      if (ctx.is_on_path(nidx))
+        continue;
+      float weight = float(dungeon::tile_cost(input[nidx]));
+      const float gScore = top.g + 1.f * weight; // we're exactly 1 unit away
+      ctx.set_on_path(nidx, true);
+      ctx.stack.push_back({p, gScore, 0}); // top is invalid from here
+    }
+    bound = nextBound;
   }
   return {};
 }
 
-static std::vector<Position> find_path_a_star(const char *input, size_t width, size_t height, Position from, Position to, float weight)
+// Scratch buffers for A*, reused between queries.
+// Cells are reset lazily: each one remembers generation it was last written in.
+struct SearchContext
+{
+  std::vector<float> g;
+  std::vector<float> f;
+  std::vector<Position> prev;
+  std::vector<uint8_t> closed;
+  std::vector<uint32_t> generation;
+  uint32_t curGeneration = 0;
+  std::vector<Position> openList;
+
+  void begin_search(size_t num_nodes)
+  {
+    if (generation.size() < num_nodes)
+    {
+      g.resize(num_nodes);
+      f.resize(num_nodes);
+      prev.resize(num_nodes);
+      closed.resize(num_nodes);
+      generation.resize(num_nodes, curGeneration);
+    }
+    openList.clear();
+    if (++curGeneration == 0) // wrapped around, old marks can't be trusted anymore
+    {
+      std::fill(generation.begin(), generation.end(), 0);
+      curGeneration = 1;
+    }
+  }
+
+  void touch(size_t idx)
+  {
+    if (generation[idx] == curGeneration)
+      return;
+    generation[idx] = curGeneration;
+    g[idx] = std::numeric_limits<float>::max();
+    f[idx] = std::numeric_limits<float>::max();
+    prev[idx] = {-1, -1};
+    closed[idx] = 0;
+  }
+};
+
+static SearchContext a_star_context;
+
+static std::vector<Position> find_path_a_star(SearchContext &ctx, const char *input, size_t width, size_t height,
+                                              Position from, Position to, float weight)
 {
   if (from.x < 0 || from.y < 0 || from.x >= int(width) || from.y >= int(height))
     return std::vector<Position>();
-  size_t inpSize = width * height;
+  ctx.begin_search(width * height);
 
-  std::vector<float> g(inpSize, std::numeric_limits<float>::max());
-  std::vector<float> f(inpSize, std::numeric_limits<float>::max());
-  std::vector<Position> prev(inpSize, {-1,-1});
+  auto getF = [&](Position p) -> float { return ctx.f[coord_to_idx(p.x, p.y, width)]; };
 
-  auto getG = [&](Position p) -> float { return g[coord_to_idx(p.x, p.y, width)]; };
-  auto getF = [&](Position p) -> float { return f[coord_to_idx(p.x, p.y, width)]; };
+  size_t fromIdx = coord_to_idx(from.x, from.y, width);
+  ctx.touch(fromIdx);
+  ctx.g[fromIdx] = 0;
+  ctx.f[fromIdx] = weight * heuristic(from, to);
 
-  g[coord_to_idx(from.x, from.y, width)] = 0;
-  f[coord_to_idx(from.x, from.y, width)] = weight * heuristic(from, to);
-
-  std::vector<Position> openList = {from};
-  std::vector<Position> closedList;
+  std::vector<Position> &openList = ctx.openList;
+  openList.push_back(from);
 
   while (!openList.empty())
   {
@@ -145,15 +273,15 @@ static std::vector<Position> find_path_a_star(const char *input, size_t width, s
       }
     }
     if (openList[bestIdx] == to)
-      return reconstruct_path(prev, to, width);
+      return reconstruct_path(ctx.prev, to, width);
     Position curPos = openList[bestIdx];
     openList.erase(openList.begin() + bestIdx);
-    if (std::find(closedList.begin(), closedList.end(), curPos) != closedList.end())
-      continue;
     size_t idx = coord_to_idx(curPos.x, curPos.y, width);
+    if (ctx.closed[idx])
+      continue;
     const Rectangle rect = {float(curPos.x), float(curPos.y), 1.f, 1.f};
-    DrawRectangleRec(rect, Color{uint8_t(g[idx]), uint8_t(g[idx]), 0, 100});
-    closedList.emplace_back(curPos);
+    DrawRectangleRec(rect, Color{uint8_t(ctx.g[idx]), uint8_t(ctx.g[idx]), 0, 100});
+    ctx.closed[idx] = 1;
     auto checkNeighbour = [&](Position p)
     {
       // out of bounds
@@ -161,17 +289,18 @@ static std::vector<Position> find_path_a_star(const char *input, size_t width, s
         return;
       size_t idx = coord_to_idx(p.x, p.y, width);
       // not empty
-      if (input[idx] == '#')
+      if (!dungeon::is_passable(input[idx]))
         return;
-      float edgeWeight = input[idx] == 'o' ? 10.f : 1.f;
-      float gScore = getG(curPos) + 1.f * edgeWeight; // we're exactly 1 unit away
-      if (gScore < getG(p))
+      bool found = ctx.generation[idx] == ctx.curGeneration; // already touched means already in OPEN or CLOSED
+      ctx.touch(idx);
+      float edgeWeight = float(dungeon::tile_cost(input[idx]));
+      float gScore = ctx.g[coord_to_idx(curPos.x, curPos.y, width)] + 1.f * edgeWeight; // we're exactly 1 unit away
+      if (gScore < ctx.g[idx])
       {
-        prev[idx] = curPos;
-        g[idx] = gScore;
-        f[idx] = gScore + weight * heuristic(p, to);
+        ctx.prev[idx] = curPos;
+        ctx.g[idx] = gScore;
+        ctx.f[idx] = gScore + weight * heuristic(p, to);
       }
-      bool found = std::find(openList.begin(), openList.end(), p) != openList.end();
       if (!found)
         openList.emplace_back(p);
     };
@@ -184,109 +313,640 @@ static std::vector<Position> find_path_a_star(const char *input, size_t width, s
   return std::vector<Position>();
 }
 
-static std::vector<Position> open_list = {};
-static std::vector<float> g;
-std::vector<Position> prev;
-std::vector<Position> visited;
+// Cells of the grid as jump point search sees them. Walkable cells other than plain floor cost more
+// to enter, so runs never jump over them: they stop on such cells and expand them like A* does
+struct JumpGrid
+{
+  const char *input;
+  size_t width;
+  size_t height;
+  Position to;
+
+  bool walkable(Position p) const
+  {
+    return p.x >= 0 && p.y >= 0 && p.x < int(width) && p.y < int(height) && dungeon::is_passable(input[coord_to_idx(p.x, p.y, width)]);
+  }
 
-static std::vector<Position> find_path_ara_star(const char *input, size_t width, size_t height, Position from, Position to, float epsilon)
+  bool plain(Position p) const
+  {
+    return walkable(p) && dungeon::tile_cost(input[coord_to_idx(p.x, p.y, width)]) == 1;
+  }
+
+  // Shortest paths are taken to go vertically first, so horizontal run only has to stop where a cell
+  // above or below opens up while going there from the previous cell would've been cheaper or impossible
+  bool jump_horizontal(Position from, int dx, Position &jump_point) const
+  {
+    for (Position cur = from;; cur.x += dx)
+    {
+      const Position next{cur.x + dx, cur.y};
+      if (!walkable(next))
+        return false;
+      if (next == to || !plain(next) ||
+          (walkable({next.x, next.y - 1}) && !plain({cur.x, cur.y - 1})) ||
+          (walkable({next.x, next.y + 1}) && !plain({cur.x, cur.y + 1})))
+      {
+        jump_point = next;
+        return true;
+      }
+    }
+  }
+
+  // Vertical run can turn anywhere, so it stops at cells from which horizontal runs find something
+  bool jump_vertical(Position from, int dy, Position &jump_point) const
+  {
+    for (Position cur = {from.x, from.y + dy}; walkable(cur); cur.y += dy)
+    {
+      Position sideJump;
+      if (cur == to || !plain(cur) || jump_horizontal(cur, 1, sideJump) || jump_horizontal(cur, -1, sideJump))
+      {
+        jump_point = cur;
+        return true;
+      }
+    }
+    return false;
+  }
+};
+
+static int sign(int v)
+{
+  return (v > 0) - (v < 0);
+}
+
+// prev links lead to previous jump points, cells between them are filled in
+static std::vector<Position> reconstruct_jump_path(const std::vector<Position> &prev, Position to, size_t width)
+{
+  std::vector<Position> res;
+  for (Position curPos = to;;)
+  {
+    const Position prevPos = prev[coord_to_idx(curPos.x, curPos.y, width)];
+    if (prevPos == Position{-1, -1})
+    {
+      res.push_back(curPos);
+      break;
+    }
+    const Position step{sign(prevPos.x - curPos.x), sign(prevPos.y - curPos.y)};
+    for (Position p = curPos; p != prevPos; p = {p.x + step.x, p.y + step.y})
+      res.push_back(p);
+    curPos = prevPos;
+  }
+  std::reverse(res.begin(), res.end());
+  return res;
+}
+
+static std::vector<Position> find_path_jps(SearchContext &ctx, const char *input, size_t width, size_t height,
+                                           Position from, Position to, float weight)
 {
   if (from.x < 0 || from.y < 0 || from.x >= int(width) || from.y >= int(height))
     return std::vector<Position>();
+  ctx.begin_search(width * height);
+  const JumpGrid grid{input, width, height, to};
+
+  auto getF = [&](Position p) -> float { return ctx.f[coord_to_idx(p.x, p.y, width)]; };
 
-  auto getG = [&](Position p) -> float { return g[coord_to_idx(p.x, p.y, width)]; };
-  auto getF = [&](Position p) -> float { return getG(p) + epsilon * heuristic(p, to); };
+  size_t fromIdx = coord_to_idx(from.x, from.y, width);
+  ctx.touch(fromIdx);
+  ctx.g[fromIdx] = 0;
+  ctx.f[fromIdx] = weight * heuristic(from, to);
 
-  std::vector<Position> closedList;
-  std::vector<Position> inconsList;
+  std::vector<Position> &openList = ctx.openList;
+  openList.push_back(from);
 
-  while (!open_list.empty())
+  while (!openList.empty())
   {
     size_t bestIdx = 0;
-    float bestScore = getF(open_list[0]);
-    for (size_t i = 1; i < open_list.size(); ++i)
+    float bestScore = getF(openList[0]);
+    for (size_t i = 1; i < openList.size(); ++i)
     {
-      float score = getF(open_list[i]);
+      float score = getF(openList[i]);
       if (score < bestScore)
       {
         bestIdx = i;
         bestScore = score;
       }
     }
-    if (getF(to) > getF(open_list[bestIdx]))
+    if (openList[bestIdx] == to)
+      return reconstruct_jump_path(ctx.prev, to, width);
+    Position curPos = openList[bestIdx];
+    openList.erase(openList.begin() + bestIdx);
+    size_t idx = coord_to_idx(curPos.x, curPos.y, width);
+    if (ctx.closed[idx])
+      continue;
+    const Rectangle rect = {float(curPos.x), float(curPos.y), 1.f, 1.f};
+    DrawRectangleRec(rect, Color{uint8_t(ctx.g[idx]), uint8_t(ctx.g[idx]), 0, 100});
+    ctx.closed[idx] = 1;
+    auto checkJump = [&](int dx, int dy)
     {
-      Position curPos = open_list[bestIdx];
-      if (std::find(visited.begin(), visited.end(), curPos) == visited.end())
-        visited.push_back(curPos);
-      open_list.erase(open_list.begin() + bestIdx);
-      closedList.emplace_back(curPos);
-      auto checkNeighbour = [&](Position p)
+      Position p;
+      if (dx != 0 ? !grid.jump_horizontal(curPos, dx, p) : !grid.jump_vertical(curPos, dy, p))
+        return;
+      size_t idx = coord_to_idx(p.x, p.y, width);
+      bool found = ctx.generation[idx] == ctx.curGeneration; // already touched means already in OPEN or CLOSED
+      ctx.touch(idx);
+      // every cell before the jump point is plain floor
+      float edgeWeight = float(dungeon::tile_cost(input[idx]));
+      float steps = float(std::abs(p.x - curPos.x) + std::abs(p.y - curPos.y));
+      float gScore = ctx.g[coord_to_idx(curPos.x, curPos.y, width)] + steps - 1.f + edgeWeight;
+      if (gScore < ctx.g[idx])
       {
-        // out of bounds
-        if (p.x < 0 || p.y < 0 || p.x >= int(width) || p.y >= int(height))
-          return;
-        size_t idx = coord_to_idx(p.x, p.y, width);
-        // not empty
-        if (input[idx] == '#')
-          return;
-        float edgeWeight = input[idx] == 'o' ? 10.f : 1.f;
-        float gScore = getG(curPos) + 1.f * edgeWeight; // we're exactly 1 unit away
-        if (gScore < getG(p))
-        {
-          prev[idx] = curPos;
-          g[idx] = gScore;
-          bool found = std::find(closedList.begin(), closedList.end(), p) != closedList.end();
-          if (!found)
-            if (std::find(open_list.begin(), open_list.end(), p) == open_list.end()) // not found in OPEN list
-              open_list.emplace_back(p);
-          else
-            if (std::find(inconsList.begin(), inconsList.end(), p) == inconsList.end()) // not found in INCONSISTENCY list
-              inconsList.emplace_back(p);
-        }
-      };
-      checkNeighbour({curPos.x + 1, curPos.y + 0});
-      checkNeighbour({curPos.x - 1, curPos.y + 0});
-      checkNeighbour({curPos.x + 0, curPos.y + 1});
-      checkNeighbour({curPos.x + 0, curPos.y - 1});
+        ctx.prev[idx] = curPos;
+        ctx.g[idx] = gScore;
+        ctx.f[idx] = gScore + weight * heuristic(p, to);
+      }
+      if (!found)
+        openList.emplace_back(p);
+    };
+    const Position prevPos = ctx.prev[idx];
+    if (prevPos == Position{-1, -1} || !grid.plain(curPos))
+    {
+      checkJump(1, 0);
+      checkJump(-1, 0);
+      checkJump(0, 1);
+      checkJump(0, -1);
+    }
+    else if (prevPos.x == curPos.x)
+    {
+      checkJump(0, sign(curPos.y - prevPos.y));
+      checkJump(1, 0);
+      checkJump(-1, 0);
     }
     else
     {
-      for (int i = 0; i < inconsList.size(); ++i)
-        if (std::find(open_list.begin(), open_list.end(), inconsList[i]) == open_list.end()) // not found in OPEN list
-          open_list.emplace_back(inconsList[i]);
-      inconsList.clear();
-      return reconstruct_path(prev, to, width);
+      // horizontal runs only turn where the cell behind had no cheap way up or down
+      const int dx = sign(curPos.x - prevPos.x);
+      checkJump(dx, 0);
+      if (!grid.plain({curPos.x - dx, curPos.y - 1}))
+        checkJump(0, -1);
+      if (!grid.plain({curPos.x - dx, curPos.y + 1}))
+        checkJump(0, 1);
     }
   }
+  // empty path
   return std::vector<Position>();
 }
 
 constexpr float EPS_START = 5.0f;
 constexpr float EPS_STEP = 0.5f;
-constexpr int FRAMES_BETWEEN_ARA_STAR_ITERATIONS = 30;
+constexpr int64_t ARA_STAR_BUDGET_US = 2000; // search time per frame
 
-static float eps = EPS_START;
-static int frames_until_next_ara_star_iteration = 0;
-static std::vector<Position> last_path;
+// Anytime planner: finds a path quickly with heuristic inflated by epsilon, then keeps lowering epsilon
+// and improving the path, reusing everything searched so far. Only cells which got cheaper since
+// they were expanded (INCONS) are searched again on every next epsilon.
+class AraStarPlanner
+{
+public:
+  void reset(const char *in_input, size_t in_width, size_t in_height, Position in_from, Position in_to)
+  {
+    input = in_input;
+    width = in_width;
+    height = in_height;
+    to = in_to;
+    eps = EPS_START;
+    finished = false;
+    bestPath.clear();
+    bestCost = std::numeric_limits<float>::max();
+    visited.clear();
+    open.clear();
+    incons.clear();
+    const size_t numCells = width * height;
+    g.assign(numCells, std::numeric_limits<float>::max());
+    prev.assign(numCells, {-1, -1});
+    closed.assign(numCells, 0);
+    queued.assign(numCells, 0);
+    isVisited.assign(numCells, 0);
+    closedStamp = 1;
+    queuedStamp = 1;
+    if (!walkable(in_from) || !walkable(to))
+    {
+      finished = true;
+      return;
+    }
+    const size_t fromIdx = coord_to_idx(in_from.x, in_from.y, width);
+    g[fromIdx] = 0.f;
+    push_open(fromIdx);
+  }
 
-static void reset_ara_star(size_t width, size_t height, Position from)
+  // Searches until path for the current epsilon is found or the budget runs out.
+  // Returns true if a better path was published
+  bool improve(int64_t budget_us)
+  {
+    if (finished)
+      return false;
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(budget_us);
+    bool improved = false;
+    size_t expansions = 0;
+    while (!finished)
+    {
+      const size_t toIdx = coord_to_idx(to.x, to.y, width);
+      while (pop_stale(), !open.empty() && g[toIdx] > open.front().key)
+      {
+        // clock is slow to ask, so it's checked every few expansions
+        if (++expansions % 64 == 0 && std::chrono::steady_clock::now() > deadline)
+          return improved;
+        expand();
+      }
+      if (g[toIdx] < std::numeric_limits<float>::max())
+      {
+        // path along prev can be cheaper than g of the goal until the goal is expanded again,
+        // so the next epsilon doesn't always give a better one
+        std::vector<Position> path = reconstruct_path(prev, to, width);
+        const float cost = path_cost(path);
+        if (cost < bestCost)
+        {
+          bestPath = std::move(path);
+          bestCost = cost;
+          improved = true;
+        }
+      }
+      if (eps <= 1.f || g[toIdx] == std::numeric_limits<float>::max())
+      {
+        finished = true;
+        break;
+      }
+      requeue(std::max(1.f, eps - EPS_STEP));
+      if (std::chrono::steady_clock::now() > deadline)
+        break;
+    }
+    return improved;
+  }
+
+  const std::vector<Position> &path() const { return bestPath; }
+
+  void draw_visited() const
+  {
+    for (size_t idx : visited)
+    {
+      const Rectangle rect = {float(idx % width), float(idx / width), 1.f, 1.f};
+      DrawRectangleRec(rect, Color{uint8_t(g[idx]), uint8_t(g[idx]), 0, 100});
+    }
+  }
+
+private:
+  struct OpenEntry
+  {
+    float key;
+    size_t idx;
+  };
+
+  static bool heap_cmp(const OpenEntry &lhs, const OpenEntry &rhs) { return lhs.key > rhs.key; }
+
+  bool walkable(Position p) const
+  {
+    return p.x >= 0 && p.y >= 0 && p.x < int(width) && p.y < int(height) && dungeon::is_passable(input[coord_to_idx(p.x, p.y, width)]);
+  }
+
+  float key_of(size_t idx) const
+  {
+    return g[idx] + eps * heuristic(Position{int(idx % width), int(idx / width)}, to);
+  }
+
+  float path_cost(const std::vector<Position> &path) const
+  {
+    float cost = 0.f;
+    for (size_t i = 1; i < path.size(); ++i)
+      cost += float(dungeon::tile_cost(input[coord_to_idx(path[i].x, path[i].y, width)]));
+    return cost;
+  }
+
+  // Cells are pushed again instead of being moved inside of the heap, older entries are dropped when they surface
+  void push_open(size_t idx)
+  {
+    open.push_back({key_of(idx), idx});
+    std::push_heap(open.begin(), open.end(), heap_cmp);
+  }
+
+  void pop_stale()
+  {
+    while (!open.empty() && (closed[open.front().idx] == closedStamp || open.front().key != key_of(open.front().idx)))
+    {
+      std::pop_heap(open.begin(), open.end(), heap_cmp);
+      open.pop_back();
+    }
+  }
+
+  void expand()
+  {
+    const size_t idx = open.front().idx;
+    std::pop_heap(open.begin(), open.end(), heap_cmp);
+    open.pop_back();
+    closed[idx] = closedStamp;
+    if (!isVisited[idx])
+    {
+      isVisited[idx] = 1;
+      visited.push_back(idx);
+    }
+    const Position curPos{int(idx % width), int(idx / width)};
+    auto checkNeighbour = [&](Position p)
+    {
+      if (!walkable(p))
+        return;
+      size_t nidx = coord_to_idx(p.x, p.y, width);
+      float edgeWeight = float(dungeon::tile_cost(input[nidx]));
+      float gScore = g[idx] + 1.f * edgeWeight; // we're exactly 1 unit away
+      if (gScore >= g[nidx])
+        return;
+      g[nidx] = gScore;
+      prev[nidx] = curPos;
+      if (closed[nidx] != closedStamp)
+        push_open(nidx);
+      else if (queued[nidx] != queuedStamp)
+      {
+        queued[nidx] = queuedStamp;
+        incons.push_back(nidx);
+      }
+    };
+    checkNeighbour({curPos.x + 1, curPos.y + 0});
+    checkNeighbour({curPos.x - 1, curPos.y + 0});
+    checkNeighbour({curPos.x + 0, curPos.y + 1});
+    checkNeighbour({curPos.x + 0, curPos.y - 1});
+  }
+
+  // Lowers epsilon, moves INCONS into OPEN and re-sorts it by keys of the new epsilon, CLOSED is emptied.
+  // Entries of closed cells and ones left behind by a cheaper push are stale and dropped, so every
+  // cell gets one entry and consistent cells aren't expanded again
+  void requeue(float new_eps)
+  {
+    std::vector<size_t> cells;
+    cells.reserve(open.size() + incons.size());
+    for (const OpenEntry &entry : open)
+      if (closed[entry.idx] != closedStamp && entry.key == key_of(entry.idx))
+        cells.push_back(entry.idx);
+    // INCONS cells are closed, so none of them is among the live entries
+    cells.insert(cells.end(), incons.begin(), incons.end());
+    incons.clear();
+    eps = new_eps;
+    ++closedStamp;
+    ++queuedStamp;
+    open.clear();
+    for (size_t idx : cells)
+      open.push_back({key_of(idx), idx});
+    std::make_heap(open.begin(), open.end(), heap_cmp);
+  }
+
+  const char *input = nullptr;
+  size_t width = 0;
+  size_t height = 0;
+  Position to;
+  float eps = EPS_START;
+  bool finished = true;
+
+  std::vector<OpenEntry> open;
+  std::vector<size_t> incons;
+  std::vector<float> g;
+  std::vector<Position> prev;
+  // cell is in CLOSED (or INCONS) while its stamp equals the current one, so both are emptied in O(1)
+  std::vector<uint32_t> closed;
+  std::vector<uint32_t> queued;
+  uint32_t closedStamp = 1;
+  uint32_t queuedStamp = 1;
+  std::vector<uint8_t> isVisited;
+  std::vector<size_t> visited;
+  std::vector<Position> bestPath;
+  float bestCost = std::numeric_limits<float>::max();
+};
+
+static AraStarPlanner ara_star;
+
+// D* Lite: searches backwards from the goal and keeps the search tree between queries. When tiles change
+// or the start moves only cells whose distance to the goal got inconsistent are searched again, so repairing
+// the path takes work proportional to the change. Moving goal roots the tree elsewhere and needs a reset.
+class DStarLitePlanner
 {
-  frames_until_next_ara_star_iteration = 0;
-  eps = EPS_START;
-  open_list = { from };
-  size_t inpSize = width * height;
-  g.clear();
-  g.resize(inpSize, std::numeric_limits<float>::max());
-  g[coord_to_idx(from.x, from.y, width)] = 0;
-  prev.clear();
-  prev.resize(inpSize, {-1,-1});
-  visited.clear();
-}
+public:
+  void reset(const char *in_input, size_t in_width, size_t in_height, Position in_from, Position in_to)
+  {
+    input = in_input;
+    width = in_width;
+    height = in_height;
+    start = in_from;
+    lastStart = in_from;
+    goal = in_to;
+    km = 0.f;
+    const size_t numCells = width * height;
+    g.assign(numCells, std::numeric_limits<float>::max());
+    rhs.assign(numCells, std::numeric_limits<float>::max());
+    openKey.assign(numCells, Key{0.f, 0.f});
+    inOpen.assign(numCells, 0);
+    open.clear();
+    bestPath.clear();
+    dirty = true;
+    if (!in_bounds(goal))
+    {
+      g.clear(); // nothing to search for
+      return;
+    }
+    // goal is kept as the root even while it's a wall, edges into walls are closed anyway
+    goalIdx = coord_to_idx(goal.x, goal.y, width);
+    rhs[goalIdx] = 0.f;
+    push_open(goalIdx);
+  }
+
+  void move_start(Position in_from)
+  {
+    // keys of queued cells were computed for the old start, instead of recomputing all of them
+    // later keys are raised by how much closer to the old start heuristic could get
+    km += manhattan(lastStart, in_from);
+    lastStart = in_from;
+    start = in_from;
+    dirty = true;
+  }
+
+  // Has to be called after tile of input changed
+  void update_tile(Position p)
+  {
+    if (g.empty() || !in_bounds(p))
+      return;
+    update_vertex(coord_to_idx(p.x, p.y, width));
+    for_each_neighbour(p, [&](size_t nidx) { update_vertex(nidx); });
+    dirty = true;
+  }
+
+  const std::vector<Position> &find_path()
+  {
+    if (!dirty)
+      return bestPath;
+    dirty = false;
+    expanded.clear();
+    bestPath.clear();
+    if (g.empty() || !walkable(start) || !walkable(goal))
+      return bestPath;
+    compute_shortest_path();
+    // walk down distances to the goal
+    size_t idx = coord_to_idx(start.x, start.y, width);
+    if (g[idx] == std::numeric_limits<float>::max())
+      return bestPath;
+    bestPath.push_back(start);
+    for (size_t steps = 0; idx != goalIdx && steps < width * height; ++steps)
+    {
+      size_t bestIdx = idx;
+      float best = std::numeric_limits<float>::max();
+      for_each_neighbour(Position{int(idx % width), int(idx / width)}, [&](size_t nidx)
+      {
+        const float v = edge_cost(idx, nidx) + g[nidx];
+        if (v < best)
+        {
+          best = v;
+          bestIdx = nidx;
+        }
+      });
+      if (bestIdx == idx)
+      {
+        bestPath.clear();
+        return bestPath;
+      }
+      idx = bestIdx;
+      bestPath.push_back(Position{int(idx % width), int(idx / width)});
+    }
+    return bestPath;
+  }
+
+  // Cells expanded by the last repair, ones raised by it can be left at infinite distance
+  void draw_expanded() const
+  {
+    for (size_t idx : expanded)
+    {
+      const Rectangle rect = {float(idx % width), float(idx / width), 1.f, 1.f};
+      const uint8_t shade = uint8_t(std::min(g[idx], 255.f));
+      DrawRectangleRec(rect, Color{shade, shade, 0, 100});
+    }
+  }
+
+private:
+  using Key = std::pair<float, float>;
+
+  struct OpenEntry
+  {
+    Key key;
+    size_t idx;
+  };
+
+  static bool heap_cmp(const OpenEntry &lhs, const OpenEntry &rhs) { return rhs.key < lhs.key; }
+
+  bool in_bounds(Position p) const
+  {
+    return p.x >= 0 && p.y >= 0 && p.x < int(width) && p.y < int(height);
+  }
+
+  bool walkable(Position p) const
+  {
+    return in_bounds(p) && dungeon::is_passable(input[coord_to_idx(p.x, p.y, width)]);
+  }
+
+  template<typename Callable>
+  void for_each_neighbour(Position p, Callable c) const
+  {
+    const Position neighbours[4] = {{p.x + 1, p.y}, {p.x - 1, p.y}, {p.x, p.y + 1}, {p.x, p.y - 1}};
+    for (const Position &n : neighbours)
+      if (in_bounds(n))
+        c(coord_to_idx(n.x, n.y, width));
+  }
+
+  // Cost of stepping from one cell into its neighbour
+  float edge_cost(size_t from_idx, size_t to_idx) const
+  {
+    if (!dungeon::is_passable(input[from_idx]) || !dungeon::is_passable(input[to_idx]))
+      return std::numeric_limits<float>::max();
+    return float(dungeon::tile_cost(input[to_idx]));
+  }
+
+  Key calculate_key(size_t idx) const
+  {
+    const float v = std::min(g[idx], rhs[idx]);
+    if (v == std::numeric_limits<float>::max())
+      return {v, v};
+    return {v + manhattan(start, Position{int(idx % width), int(idx / width)}) + km, v};
+  }
+
+  // Cells are pushed again instead of being moved inside of the heap, older entries are dropped when they surface
+  void push_open(size_t idx)
+  {
+    openKey[idx] = calculate_key(idx);
+    inOpen[idx] = 1;
+    open.push_back({openKey[idx], idx});
+    std::push_heap(open.begin(), open.end(), heap_cmp);
+  }
+
+  void pop_stale()
+  {
+    while (!open.empty() && (!inOpen[open.front().idx] || open.front().key != openKey[open.front().idx]))
+    {
+      std::pop_heap(open.begin(), open.end(), heap_cmp);
+      open.pop_back();
+    }
+  }
+
+  void update_vertex(size_t idx)
+  {
+    if (idx != goalIdx)
+    {
+      float best = std::numeric_limits<float>::max();
+      for_each_neighbour(Position{int(idx % width), int(idx / width)}, [&](size_t nidx)
+      {
+        const float cost = edge_cost(idx, nidx);
+        if (cost < std::numeric_limits<float>::max() && g[nidx] < std::numeric_limits<float>::max())
+          best = std::min(best, cost + g[nidx]);
+      });
+      rhs[idx] = best;
+    }
+    inOpen[idx] = 0;
+    if (g[idx] != rhs[idx])
+      push_open(idx);
+  }
+
+  void compute_shortest_path()
+  {
+    const size_t startIdx = coord_to_idx(start.x, start.y, width);
+    while (pop_stale(), !open.empty() && (open.front().key < calculate_key(startIdx) || rhs[startIdx] != g[startIdx]))
+    {
+      const Key oldKey = open.front().key;
+      const size_t idx = open.front().idx;
+      std::pop_heap(open.begin(), open.end(), heap_cmp);
+      open.pop_back();
+      inOpen[idx] = 0;
+      const Key newKey = calculate_key(idx);
+      if (oldKey < newKey)
+      {
+        push_open(idx);
+        continue;
+      }
+      expanded.push_back(idx);
+      if (g[idx] > rhs[idx])
+        g[idx] = rhs[idx];
+      else
+      {
+        g[idx] = std::numeric_limits<float>::max();
+        update_vertex(idx);
+      }
+      for_each_neighbour(Position{int(idx % width), int(idx / width)}, [&](size_t nidx) { update_vertex(nidx); });
+    }
+  }
+
+  const char *input = nullptr;
+  size_t width = 0;
+  size_t height = 0;
+  Position start;
+  Position lastStart;
+  Position goal;
+  size_t goalIdx = 0;
+  float km = 0.f;
+  std::vector<float> g;
+  std::vector<float> rhs;
+  std::vector<Key> openKey;
+  std::vector<uint8_t> inOpen;
+  std::vector<OpenEntry> open;
+  std::vector<size_t> expanded;
+  std::vector<Position> bestPath;
+  bool dirty = true;
+};
+
+static DStarLitePlanner d_star_lite;
 
 enum PathFindingMode
 {
   A_STAR,
-  ARA_STAR
+  ARA_STAR,
+  JPS,
+  IDA_STAR,
+  D_STAR_LITE
 };
 
 void draw_nav_data(const char *input, size_t width, size_t height, Position from, Position to, float weight, PathFindingMode mode)
@@ -296,29 +956,43 @@ void draw_nav_data(const char *input, size_t width, size_t height, Position from
   {
     case A_STAR:
     {
-      std::vector<Position> path = find_path_a_star(input, width, height, from, to, weight);
+      std::vector<Position> path = find_path_a_star(a_star_context, input, width, height, from, to, weight);
       draw_path(path);
       break;
     }
     
-    case ARA_STAR:
+    case JPS:
     {
-      frames_until_next_ara_star_iteration--;
-      if (frames_until_next_ara_star_iteration < 0)
-      {
-        eps -= EPS_STEP;
-        if (eps < 1.f || open_list.empty())
-          reset_ara_star(width, height, from);
-        frames_until_next_ara_star_iteration = FRAMES_BETWEEN_ARA_STAR_ITERATIONS;
-        last_path = find_path_ara_star(input, width, height, from, to, eps);
-      }
-      for (int i = 0; i < visited.size(); i++)
+      std::vector<Position> path = find_path_jps(a_star_context, input, width, height, from, to, weight);
+      draw_path(path);
+      break;
+    }
+
+    case IDA_STAR:
+    {
+      if (!ida_star_context.hasPath)
       {
-        size_t idx = coord_to_idx(visited[i].x, visited[i].y, width);
-        const Rectangle rect = {float(visited[i].x), float(visited[i].y), 1.f, 1.f};
-        DrawRectangleRec(rect, Color{uint8_t(g[idx]), uint8_t(g[idx]), 0, 100});
+        ida_star_context.path = find_ida_star_path(ida_star_context, input, width, height, from, to,
+                                                   IDA_STAR_MAX_EXPANSIONS);
+        ida_star_context.hasPath = true;
       }
-      draw_path(last_path);
+      draw_path(ida_star_context.path);
+      break;
+    }
+
+    case D_STAR_LITE:
+    {
+      const std::vector<Position> &path = d_star_lite.find_path();
+      d_star_lite.draw_expanded();
+      draw_path(path);
+      break;
+    }
+
+    case ARA_STAR:
+    {
+      ara_star.improve(ARA_STAR_BUDGET_US);
+      ara_star.draw_visited();
+      draw_path(ara_star.path());
       break;
     }
   }
@@ -348,6 +1022,9 @@ int main(int /*argc*/, const char ** /*argv*/)
 
   Position from = dungeon::find_walkable_tile(navGrid, dungWidth, dungHeight);
   Position to = dungeon::find_walkable_tile(navGrid, dungWidth, dungHeight);
+  ara_star.reset(navGrid, dungWidth, dungHeight, from, to);
+  ida_star_context.invalidate_path();
+  d_star_lite.reset(navGrid, dungWidth, dungHeight, from, to);
 
   Camera2D camera = { {0, 0}, {0, 0}, 0.f, 1.f };
   //camera.offset = Vector2{ width * 0.5f, height * 0.5f };
@@ -364,19 +1041,29 @@ int main(int /*argc*/, const char ** /*argv*/)
     {
       size_t idx = coord_to_idx(p.x, p.y, dungWidth);
       if (idx < dungWidth * dungHeight)
-        navGrid[idx] = navGrid[idx] == ' ' ? '#' : navGrid[idx] == '#' ? 'o' : ' ';
+      {
+        navGrid[idx] = navGrid[idx] == dungeon::floor ? dungeon::wall :
+                       navGrid[idx] == dungeon::wall ? dungeon::water : dungeon::floor;
+        ara_star.reset(navGrid, dungWidth, dungHeight, from, to);
+        ida_star_context.invalidate_path();
+        d_star_lite.update_tile(p);
+      }
     }
     else if (IsMouseButtonPressed(0))
     {
       Position &target = from;
       target = p;
-      reset_ara_star(dungWidth, dungHeight, from);
+      ara_star.reset(navGrid, dungWidth, dungHeight, from, to);
+      ida_star_context.invalidate_path();
+      d_star_lite.move_start(from);
     }
     else if (IsMouseButtonPressed(1))
     {
       Position &target = to;
       target = p;
-      reset_ara_star(dungWidth, dungHeight, from);
+      ara_star.reset(navGrid, dungWidth, dungHeight, from, to);
+      ida_star_context.invalidate_path();
+      d_star_lite.reset(navGrid, dungWidth, dungHeight, from, to);
     }
     if (IsKeyPressed(KEY_SPACE))
     {
@@ -384,7 +1071,9 @@ int main(int /*argc*/, const char ** /*argv*/)
       spill_drunk_water(navGrid, dungWidth, dungHeight, 8, 10);
       from = dungeon::find_walkable_tile(navGrid, dungWidth, dungHeight);
       to = dungeon::find_walkable_tile(navGrid, dungWidth, dungHeight);
-      reset_ara_star(dungWidth, dungHeight, from);
+      ara_star.reset(navGrid, dungWidth, dungHeight, from, to);
+      ida_star_context.invalidate_path();
+      d_star_lite.reset(navGrid, dungWidth, dungHeight, from, to);
     }
     if (IsKeyPressed(KEY_UP))
     {
@@ -400,6 +1089,12 @@ int main(int /*argc*/, const char ** /*argv*/)
       mode = ARA_STAR;
     if (IsKeyPressed(KEY_TWO))
       mode = A_STAR;
+    if (IsKeyPressed(KEY_THREE))
+      mode = JPS;
+    if (IsKeyPressed(KEY_FOUR))
+      mode = IDA_STAR;
+    if (IsKeyPressed(KEY_FIVE))
+      mode = D_STAR_LITE;
     BeginDrawing();
       ClearBackground(BLACK);
       BeginMode2D(camera);
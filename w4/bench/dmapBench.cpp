@@ -0,0 +1,153 @@
+// Compares Dijkstra map solvers on generated maps: repeated grid scan dmaps used to be built with,
+// bucket queue and vectorised row sweeps. All of them have to produce the same map from whole-valued sources,
+// flee maps built from fractional ones are only checked for how far sweeps drift from buckets.
+// Usage: hw4_bench [map size] [1 to run scan, 0 to skip it]
+#include "dmapKernel.h"
+#include "dungeonUtils.h"
+#include "benchMaps.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+
+constexpr float invalid_tile_value = 1e5f;
+
+// The scan process_dmap was before it got replaced with solvers from dmapKernel
+static void relax_scan(std::vector<float> &map, const DungeonData &dd)
+{
+  bool done = false;
+  auto getMapAt = [&](size_t x, size_t y, float def)
+  {
+    if (x < dd.width && y < dd.height && dd.tiles[y * dd.width + x] == dungeon::floor)
+      return map[y * dd.width + x];
+    return def;
+  };
+  auto getMinNei = [&](size_t x, size_t y)
+  {
+    float val = map[y * dd.width + x];
+    val = std::min(val, getMapAt(x - 1, y + 0, val));
+    val = std::min(val, getMapAt(x + 1, y + 0, val));
+    val = std::min(val, getMapAt(x + 0, y - 1, val));
+    val = std::min(val, getMapAt(x + 0, y + 1, val));
+    return val;
+  };
+  while (!done)
+  {
+    done = true;
+    for (size_t y = 0; y < dd.height; ++y)
+      for (size_t x = 0; x < dd.width; ++x)
+      {
+        const size_t i = y * dd.width + x;
+        if (dd.tiles[i] != dungeon::floor)
+          continue;
+        const float myVal = getMapAt(x, y, invalid_tile_value);
+        const float minVal = getMinNei(x, y);
+        if (minVal < myVal - 1.f)
+        {
+          map[i] = minVal + 1.f;
+          done = false;
+        }
+      }
+  }
+}
+
+// Best of several runs, every run starts from the same sources
+template<typename Solver>
+static double time_solver(const std::vector<float> &sources, std::vector<float> &map, int runs, Solver solve)
+{
+  double best = 0.0;
+  for (int run = 0; run < runs; ++run)
+  {
+    map = sources;
+    auto start = std::chrono::steady_clock::now();
+    solve(map);
+    const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    if (run == 0 || ms < best)
+      best = ms;
+  }
+  return best;
+}
+
+static float max_difference(const std::vector<float> &a, const std::vector<float> &b)
+{
+  float diff = 0.f;
+  for (size_t i = 0; i < a.size(); ++i)
+    diff = std::max(diff, std::abs(a[i] - b[i]));
+  return diff;
+}
+
+static void bench_map(const char *name, const DungeonData &dd, bool with_scan)
+{
+  std::vector<size_t> floors;
+  for (size_t i = 0; i < dd.tiles.size(); ++i)
+    if (dd.tiles[i] == dungeon::floor)
+      floors.push_back(i);
+  if (floors.empty())
+    return;
+  std::mt19937 rng(1);
+  std::vector<float> sources(dd.tiles.size(), invalid_tile_value);
+  for (int i = 0; i < 3; ++i)
+    sources[floors[rng() % floors.size()]] = 0.f;
+
+  std::vector<float> scanMap;
+  std::vector<float> bucketsMap;
+  std::vector<float> sweepsMap;
+  const double scanMs = with_scan ? time_solver(sources, scanMap, 1, [&](std::vector<float> &map)
+  {
+    relax_scan(map, dd);
+  }) : 0.0;
+  const double bucketsMs = time_solver(sources, bucketsMap, 5, [&](std::vector<float> &map)
+  {
+    dmaps::relax_buckets(map, dd);
+  });
+  const double sweepsMs = time_solver(sources, sweepsMap, 5, [&](std::vector<float> &map)
+  {
+    dmaps::relax_sweeps(map, dd);
+  });
+  const bool same = bucketsMap == sweepsMap && (!with_scan || scanMap == bucketsMap);
+  if (with_scan)
+    printf("%-20s %10.2f %10.2f %10.2f %6s\n", name, scanMs, bucketsMs, sweepsMs, same ? "yes" : "NO");
+  else
+    printf("%-20s %10s %10.2f %10.2f %6s\n", name, "-", bucketsMs, sweepsMs, same ? "yes" : "NO");
+
+  // flee map the way the game makes it: approach map scaled by -1.2 and relaxed again
+  std::vector<float> flee = bucketsMap;
+  for (float &v : flee)
+    if (v < invalid_tile_value)
+      v *= -1.2f;
+  std::vector<float> fleeBucketsMap;
+  std::vector<float> fleeSweepsMap;
+  const double fleeBucketsMs = time_solver(flee, fleeBucketsMap, 5, [&](std::vector<float> &map)
+  {
+    dmaps::relax_buckets(map, dd);
+  });
+  const double fleeSweepsMs = time_solver(flee, fleeSweepsMap, 5, [&](std::vector<float> &map)
+  {
+    dmaps::relax_sweeps(map, dd);
+  });
+  printf("%-20s %10s %10.2f %10.2f %6s max diff %g\n", "  flee", "-", fleeBucketsMs, fleeSweepsMs,
+         fleeBucketsMap == fleeSweepsMap ? "yes" : "no", double(max_difference(fleeBucketsMap, fleeSweepsMap)));
+}
+
+int main(int argc, char **argv)
+{
+  const size_t mapSize = argc > 1 ? size_t(atoi(argv[1])) : 1024;
+  // scan goes over the whole map once per step of the longest path, it takes a while on big maps
+  const bool withScan = argc > 2 ? atoi(argv[2]) != 0 : mapSize <= 512;
+#if defined(__AVX__)
+  printf("sweeps use AVX\n");
+#elif defined(__SSE2__) || defined(_M_X64)
+  printf("sweeps use SSE\n");
+#else
+  printf("sweeps are scalar\n");
+#endif
+  printf("%zux%zu, ms\n", mapSize, mapSize);
+  printf("%-20s %10s %10s %10s %6s\n", "map", "scan", "buckets", "sweeps", "same");
+  bench_map("empty", gen_noise_map(mapSize, mapSize, 0.f, 1), withScan);
+  bench_map("open (10% walls)", gen_noise_map(mapSize, mapSize, 0.1f, 2), withScan);
+  bench_map("noisy (30% walls)", gen_noise_map(mapSize, mapSize, 0.3f, 3), withScan);
+  bench_map("drunk (40% floor)", gen_drunk_map(mapSize, mapSize, 0.4f, 4), withScan);
+  return 0;
+}
@@ -0,0 +1,82 @@
+// Compares memory taken by Dijkstra maps kept as floats and packed into 16 and 8 bits,
+// and time of follower-like lookups (five neighbouring cells of every map) at random cells.
+// Usage: hw4_storage_bench [map size] [lookups]
+#include "dmapKernel.h"
+#include "dungeonUtils.h"
+#include "benchMaps.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+static size_t storage_bytes(const DijkstraMapData &dmap)
+{
+  return dmap.map.capacity() * sizeof(float) + dmap.fixed16.capacity() * sizeof(uint16_t) +
+         dmap.saturated8.capacity() * sizeof(uint8_t);
+}
+
+int main(int argc, char **argv)
+{
+  const size_t mapSize = argc > 1 ? size_t(atoi(argv[1])) : 1024;
+  const size_t numLookups = argc > 2 ? size_t(atoi(argv[2])) : 2000000;
+  constexpr size_t numMaps = 6; // as many as w4 generates every turn
+
+  const DungeonData dd = gen_drunk_map(mapSize, mapSize, 0.4f, 1);
+  std::vector<size_t> floors;
+  for (size_t i = 0; i < dd.tiles.size(); ++i)
+    if (dd.tiles[i] == dungeon::floor)
+      floors.push_back(i);
+  std::mt19937 rng(2);
+  std::vector<std::vector<float>> values(numMaps);
+  for (std::vector<float> &map : values)
+  {
+    map.assign(dd.tiles.size(), DijkstraMapData::invalid_value);
+    for (int i = 0; i < 4; ++i)
+      map[floors[rng() % floors.size()]] = 0.f;
+    dmaps::relax_buckets(map, dd);
+  }
+  // followers stand on floor inside of the map, so their neighbours are always there
+  std::vector<size_t> cells(numLookups);
+  for (size_t &cell : cells)
+    cell = floors[rng() % floors.size()];
+  const ptrdiff_t width = ptrdiff_t(dd.width);
+  const ptrdiff_t moveOffsets[5] = {0, -1, 1, width, -width};
+
+  printf("%zu maps %zux%zu, %zu lookups of 5 cells in every map\n", numMaps, mapSize, mapSize, numLookups);
+  printf("%-12s %12s %12s %12s\n", "storage", "memory,KB", "lookups,ms", "max error");
+  const std::pair<const char *, DmapStorage> storages[] = {
+    {"float", DmapStorage::Float}, {"fixed16", DmapStorage::Fixed16}, {"saturated8", DmapStorage::Saturated8}};
+  for (const auto &[name, storage] : storages)
+  {
+    std::vector<DijkstraMapData> dmaps(numMaps);
+    size_t bytes = 0;
+    float maxError = 0.f;
+    for (size_t m = 0; m < numMaps; ++m)
+    {
+      dmaps[m].store(values[m], storage);
+      bytes += storage_bytes(dmaps[m]);
+      for (size_t i = 0; i < values[m].size(); ++i)
+        if (values[m][i] < DijkstraMapData::invalid_value)
+          maxError = std::max(maxError, std::fabs(dmaps[m].at(i) - values[m][i]));
+    }
+
+    float checksum = 0.f;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t cell : cells)
+    {
+      float best = DijkstraMapData::invalid_value * float(numMaps);
+      for (ptrdiff_t offset : moveOffsets)
+      {
+        float sum = 0.f;
+        for (const DijkstraMapData &dmap : dmaps)
+          sum += dmap.at(size_t(ptrdiff_t(cell) + offset));
+        best = std::min(best, sum);
+      }
+      checksum += best;
+    }
+    const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    printf("%-12s %12zu %12.2f %12.3f (checksum %g)\n", name, bytes / 1024, ms, double(maxError), double(checksum));
+  }
+  return 0;
+}
@@ -1,7 +1,10 @@
 #include "dijkstraMapGen.h"
 #include "ecsTypes.h"
 #include "dungeonUtils.h"
-#include <queue>
+#include "dmapKernel.h"
+#include "fov.h"
+#include <algorithm>
+#include <iterator>
 
 template<typename Callable>
 static void query_dungeon_data(flecs::world &ecs, Callable c)
@@ -20,6 +23,7 @@ static void query_characters_positions(flecs::world &ecs, Callable c)
 }
 
 constexpr float invalid_tile_value = 1e5f;
+constexpr int player_vision_radius = 16;
 
 static void init_tiles(std::vector<float> &map, const DungeonData &dd)
 {
@@ -28,225 +32,275 @@ static void init_tiles(std::vector<float> &map, const DungeonData &dd)
     v = invalid_tile_value;
 }
 
-// scan version, could be implemented as Dijkstra version as well
-static void process_dmap(std::vector<float> &map, const DungeonData &dd)
+// Sweeps are faster on open dungeons, where paths turn only a few times, and buckets on twisted ones.
+// When sweeps don't converge quickly they aren't tried for this map until its dungeon changes
+static void process_dmap(std::vector<float> &map, const DungeonData &dd, dmaps::SolverState &solver)
 {
-  bool done = false;
-  auto getMapAt = [&](size_t x, size_t y, float def)
+  if (solver.dungeonVersion != dd.version)
   {
-    if (x < dd.width && y < dd.width && dd.tiles[y * dd.width + x] == dungeon::floor)
-      return map[y * dd.width + x];
-    return def;
-  };
-  auto getMinNei = [&](size_t x, size_t y)
-  {
-    float val = map[y * dd.width + x];
-    val = std::min(val, getMapAt(x - 1, y + 0, val));
-    val = std::min(val, getMapAt(x + 1, y + 0, val));
-    val = std::min(val, getMapAt(x + 0, y - 1, val));
-    val = std::min(val, getMapAt(x + 0, y + 1, val));
-    return val;
-  };
-  while (!done)
+    solver.dungeonVersion = dd.version;
+    solver.twistedDungeon = false;
+  }
+  if (solver.twistedDungeon || !dmaps::relax_sweeps(map, dd, 4))
   {
-    done = true;
-    for (size_t y = 0; y < dd.height; ++y)
-      for (size_t x = 0; x < dd.width; ++x)
-      {
-        const size_t i = y * dd.width + x;
-        if (dd.tiles[i] != dungeon::floor)
-          continue;
-        const float myVal = getMapAt(x, y, invalid_tile_value);
-        const float minVal = getMinNei(x, y);
-        if (minVal < myVal - 1.f)
-        {
-          map[i] = minVal + 1.f;
-          done = false;
-        }
-      }
+    solver.twistedDungeon = true;
+    dmaps::relax_buckets(map, dd);
   }
 }
 
-void dmaps::gen_player_approach_map(flecs::world &ecs, std::vector<float> &map)
+void dmaps::gather_sources(flecs::world &ecs, DmapSources &sources)
 {
-  query_dungeon_data(ecs, [&](const DungeonData &dd)
+  static auto hiveQuery = ecs.query<const Position, const Hive>();
+
+  sources.hasDungeon = false;
+  // sources are kept between turns, dungeon and exploration are copied only when they changed
+  query_dungeon_data(ecs, [&](flecs::entity e, const DungeonData &dd)
   {
-    init_tiles(map, dd);
-    query_characters_positions(ecs, [&](const Position &pos, const Team &t)
+    const bool newDungeon = sources.dungeon.version != dd.version;
+    if (newDungeon)
+      sources.dungeon = dd;
+    sources.hasDungeon = true;
+    e.get([&](const DungeonExploration &exploration)
     {
-      if (t.team == 0) // player team hardcode
-        map[pos.y * dd.width + pos.x] = 0.f;
+      if (newDungeon || sources.exploration.version != exploration.version)
+        sources.exploration = exploration;
     });
-    process_dmap(map, dd);
+  });
+  sources.players.clear();
+  sources.allies.clear();
+  query_characters_positions(ecs, [&](flecs::entity e, const Position &pos, const Team &t)
+  {
+    if (t.team == 0) // player team hardcode
+      sources.players.push_back(pos);
+    else if (t.team == 1 // hardcoding enemy team
+      && !e.has<ShootDamage>()) // and not a mage
+      sources.allies.push_back(pos);
+  });
+  sources.hives.clear();
+  hiveQuery.each([&](const Position &pos, const Hive &)
+  {
+    sources.hives.push_back(pos);
   });
 }
 
-static float visibility_value(const std::vector<float> &map, const DungeonData &dd, const Position &pos, const Position &npos)
+static void gen_sources_map(const DungeonData &dd, const std::vector<Position> &positions,
+                            dmaps::SolverState &solver, std::vector<float> &map)
 {
-  int dir_x = 2 * (pos.x > npos.x) - 1;
-  int dir_y = 2 * (pos.y > npos.y) - 1;
-  float new_val = 0;
-  if (abs(pos.x - npos.x) > abs(pos.y - npos.y))
-    new_val = map[npos.y * dd.width + (npos.x + dir_x)] + 1 + 
-              (dd.tiles[pos.y * dd.width + (pos.x - dir_x)] == dungeon::wall) * invalid_tile_value;
-  else if (abs(pos.x - npos.x) == abs(pos.y - npos.y))
-    new_val = map[(npos.y + dir_y) * dd.width + (npos.x + dir_x)] + 2 +
-              (dd.tiles[(pos.y - dir_y) * dd.width + (pos.x - dir_x)] == dungeon::wall) * invalid_tile_value;
-  else
-    new_val = map[(npos.y + dir_y) * dd.width + npos.x] + 1 +
-              (dd.tiles[(pos.y - dir_y) * dd.width + pos.x] == dungeon::wall) * invalid_tile_value;
-  return std::min(new_val, invalid_tile_value);
+  init_tiles(map, dd);
+  for (const Position &pos : positions)
+    map[pos.y * dd.width + pos.x] = 0.f;
+  process_dmap(map, dd, solver);
 }
 
-using tail = std::pair<float, std::pair<int, int>>;
+template<typename Callable>
+static void for_each_floor_neighbour(const DungeonData &dd, size_t i, Callable c)
+{
+  const size_t x = i % dd.width;
+  const size_t y = i / dd.width;
+  auto visit = [&](size_t ni)
+  {
+    if (dd.tiles[ni] == dungeon::floor)
+      c(ni);
+  };
+  if (x > 0)
+    visit(i - 1);
+  if (x + 1 < dd.width)
+    visit(i + 1);
+  if (y > 0)
+    visit(i - dd.width);
+  if (y + 1 < dd.height)
+    visit(i + dd.width);
+}
 
-static void gen_player_vision_map(flecs::world &ecs, std::vector<float> &map)
+// Repairs map built for previous sources into the one gen_sources_map would build for current sources.
+// Raise: starting from removed sources, cells which lost their last neighbour a step closer
+// to a source are reset wave by wave. Lower: distances flow back into reset cells from
+// their intact neighbours and out of added sources. Only changed cells and their border are visited.
+static void repair_sources_map(const DungeonData &dd, const std::vector<size_t> &removed,
+                               const std::vector<size_t> &added, std::vector<float> &map)
 {
-  query_dungeon_data(ecs, [&](const DungeonData &dd)
+  std::vector<std::pair<size_t, float>> raised; // cell and value it had, in order of increasing values
+  for (size_t i : removed)
   {
-    init_tiles(map, dd);
-    query_characters_positions(ecs, [&](const Position &ppos, const Team &t)
+    raised.push_back({i, map[i]});
+    map[i] = invalid_tile_value;
+  }
+  // all cells of one wave are reset before the next wave checks their neighbours,
+  // so a neighbour still holding value one less is a valid support
+  for (size_t k = 0; k < raised.size(); ++k)
+  {
+    if (dd.tiles[raised[k].first] != dungeon::floor) // sources on walls don't spread
+      continue;
+    const float oldVal = raised[k].second;
+    for_each_floor_neighbour(dd, raised[k].first, [&](size_t ni)
+    {
+      if (map[ni] != oldVal + 1.f)
+        return;
+      bool supported = false;
+      for_each_floor_neighbour(dd, ni, [&](size_t si) { supported |= map[si] == map[ni] - 1.f; });
+      if (supported)
+        return;
+      raised.push_back({ni, map[ni]});
+      map[ni] = invalid_tile_value;
+    });
+  }
+
+  std::vector<size_t> seeds;
+  for (const std::pair<size_t, float> &cell : raised)
+    for_each_floor_neighbour(dd, cell.first, [&](size_t ni)
     {
-      if (t.team == 0) // player team hardcode
+      if (map[ni] < invalid_tile_value)
+        seeds.push_back(ni);
+    });
+  for (size_t i : added)
+  {
+    map[i] = 0.f;
+    if (dd.tiles[i] == dungeon::floor)
+      seeds.push_back(i);
+  }
+  if (seeds.empty())
+    return;
+
+  // same bucket queue as relax_buckets, but seeded only by the border of the changed region
+  float lowest = invalid_tile_value;
+  for (size_t i : seeds)
+    lowest = std::min(lowest, map[i]);
+  std::vector<std::vector<size_t>> buckets;
+  auto push = [&](size_t i)
+  {
+    const size_t bucket = size_t(map[i] - lowest);
+    if (bucket >= buckets.size())
+      buckets.resize(bucket + 1);
+    buckets[bucket].push_back(i);
+  };
+  for (size_t i : seeds)
+    push(i);
+  for (size_t bucket = 0; bucket < buckets.size(); ++bucket)
+    for (size_t k = 0; k < buckets[bucket].size(); ++k)
+    {
+      const size_t i = buckets[bucket][k];
+      const float val = map[i];
+      if (size_t(val - lowest) != bucket) // lowered again after it was queued
+        continue;
+      for_each_floor_neighbour(dd, i, [&](size_t ni)
       {
-        map[ppos.y * dd.width + ppos.x] = 0.f;
-        // Dijkstra's algorithm
-        std::priority_queue<tail, std::vector<tail>, std::greater<tail>> queue;
-        std::vector<bool> visited(map.size(), false);
-        queue.push({0., {ppos.x, ppos.y}});
-        auto atPos = [&](int x, int y) { return y * dd.width + x; };
-        while (!queue.empty()) 
+        if (val < map[ni] - 1.f)
         {
-          auto [valAtPos, pos] = queue.top();
-          auto [pos_x, pos_y] = pos;
-          queue.pop();
-
-          if (visited[atPos(pos_x, pos_y)])
-            continue;
-
-          visited[atPos(pos_x, pos_y)] = true;
-          map[atPos(pos_x, pos_y)] = valAtPos;
-
-          if (pos_x > 0 && !visited[atPos(pos_x - 1, pos_y)] &&  dd.tiles[atPos(pos_x - 1, pos_y)] == dungeon::floor)
-          {
-            float val = visibility_value(map, dd, ppos, {pos_x - 1, pos_y});
-            if (map[atPos(pos_x - 1, pos_y)] > val)
-            {
-              map[atPos(pos_x - 1, pos_y)] = val;  
-              queue.push({val, {pos_x - 1, pos_y}});
-            }
-          }
-
-          if (pos_x < dd.width - 1 && !visited[atPos(pos_x + 1, pos_y)] && dd.tiles[atPos(pos_x + 1, pos_y)] == dungeon::floor)
-          {
-            float val = visibility_value(map, dd, ppos, {pos_x + 1, pos_y});
-            if (map[atPos(pos_x + 1, pos_y)] > val)
-            {
-              map[atPos(pos_x + 1, pos_y)] = val;  
-              queue.push({val, {pos_x + 1, pos_y}});
-            }
-          }
-
-          if (pos_y > 0 && !visited[atPos(pos_x, pos_y - 1)] && dd.tiles[atPos(pos_x, pos_y - 1)] == dungeon::floor)
-          {
-            float val = visibility_value(map, dd, ppos, {pos_x, pos_y - 1});
-            if (map[atPos(pos_x, pos_y - 1)] > val)
-            {
-              map[atPos(pos_x, pos_y - 1)] = val;  
-              queue.push({val, {pos_x, pos_y - 1}});
-            }
-          }
-
-          if (pos_y < dd.height - 1 && !visited[atPos(pos_x, pos_y + 1)] && dd.tiles[atPos(pos_x, pos_y + 1)] == dungeon::floor)
-          {
-            float val = visibility_value(map, dd, ppos, {pos_x, pos_y + 1});
-            if (map[atPos(pos_x, pos_y + 1)] > val)
-            {
-              map[atPos(pos_x, pos_y + 1)] = val;  
-              queue.push({val, {pos_x, pos_y + 1}});
-            }
-          }
+          map[ni] = val + 1.f;
+          push(ni);
         }
-      }
-    });
-  });
+      });
+    }
 }
 
-void dmaps::gen_player_flee_map(flecs::world &ecs, std::vector<float> &map)
+static void update_sources_map(const DungeonData &dd, const std::vector<Position> &positions,
+                               dmaps::SourcesMapState &state, std::vector<float> &map)
 {
-  ecs.entity("approach_map").get([&](const DijkstraMapData &dmap) {
-    map = dmap.map;
-  });
+  std::vector<size_t> sources;
+  sources.reserve(positions.size());
+  for (const Position &pos : positions)
+    sources.push_back(pos.y * dd.width + pos.x);
+  std::sort(sources.begin(), sources.end());
+  sources.erase(std::unique(sources.begin(), sources.end()), sources.end());
+
+  // dungeon changed or map was dropped since last turn, nothing to repair
+  if (map.size() != dd.width * dd.height || state.solver.dungeonVersion != dd.version)
+  {
+    gen_sources_map(dd, positions, state.solver, map);
+    state.sources = std::move(sources);
+    return;
+  }
+  std::vector<size_t> removed;
+  std::vector<size_t> added;
+  std::set_difference(state.sources.begin(), state.sources.end(), sources.begin(), sources.end(),
+                      std::back_inserter(removed));
+  std::set_difference(sources.begin(), sources.end(), state.sources.begin(), state.sources.end(),
+                      std::back_inserter(added));
+  // when every old source is gone whole map is raised anyway, it's cheaper to flood it once
+  if (!removed.empty() && removed.size() == state.sources.size())
+    gen_sources_map(dd, positions, state.solver, map);
+  else if (!removed.empty() || !added.empty())
+    repair_sources_map(dd, removed, added, map);
+  state.sources = std::move(sources);
+}
+
+void dmaps::gen_player_approach_map(const DmapSources &sources, SourcesMapState &state, std::vector<float> &map)
+{
+  update_sources_map(sources.dungeon, sources.players, state, map);
+}
+
+void dmaps::gen_player_flee_map(const DmapSources &sources, const std::vector<float> &approach_map,
+                                SolverState &solver, std::vector<float> &map)
+{
+  map = approach_map;
   for (float &v : map)
     if (v < invalid_tile_value)
       v *= -1.2f;
-  query_dungeon_data(ecs, [&](const DungeonData &dd)
-  {
-    process_dmap(map, dd);
-  });
+  process_dmap(map, sources.dungeon, solver);
 }
 
-void dmaps::gen_hive_pack_map(flecs::world &ecs, std::vector<float> &map)
+void dmaps::gen_hive_pack_map(const DmapSources &sources, SourcesMapState &state, std::vector<float> &map)
 {
-  static auto hiveQuery = ecs.query<const Position, const Hive>();
-  query_dungeon_data(ecs, [&](const DungeonData &dd)
-  {
-    init_tiles(map, dd);
-    hiveQuery.each([&](const Position &pos, const Hive &)
-    {
-      map[pos.y * dd.width + pos.x] = 0.f;
-    });
-    process_dmap(map, dd);
-  });
+  update_sources_map(sources.dungeon, sources.hives, state, map);
 }
 
-void dmaps::gen_mage_map(flecs::world &ecs, std::vector<float> &map)
+void dmaps::gen_mage_map(const DmapSources &sources, const std::vector<float> &approach_map, std::vector<float> &map)
 {
-  ecs.entity("approach_map").get([&](const DijkstraMapData &dmap) {
-    map = dmap.map;
-  });
-  std::vector<float> visionMap;
-  gen_player_vision_map(ecs, visionMap);
-  for (size_t i = 0; i < map.size(); i++)
+  map = approach_map;
+  static thread_local fov::VisibilityMap vision;
+  vision.reset(sources.dungeon.width, sources.dungeon.height);
+  for (const Position &ppos : sources.players)
+    fov::compute(sources.dungeon, ppos, player_vision_radius, vision);
+  for (size_t i : vision.lit_cells())
   {
     float approachValue = map[i];
-    float visionValue = visionMap[i];
     if (approachValue < invalid_tile_value)
-    {
-      if (visionValue < invalid_tile_value)
-        // Player not seeing mage is the same as mage not seeing player
-        map[i] = abs(approachValue - 4.f);
-    }
+      // Player not seeing mage is the same as mage not seeing player
+      map[i] = abs(approachValue - 4.f);
   }
 }
 
-void dmaps::gen_ally_map(flecs::world &ecs, std::vector<float> &map)
+void dmaps::gen_ally_map(const DmapSources &sources, SourcesMapState &state, std::vector<float> &map)
 {
-  // static auto allyQuery = ecs.query<const Position, const Team>();
-  query_dungeon_data(ecs, [&](const DungeonData &dd)
-  {
-    init_tiles(map, dd);
-    query_characters_positions(ecs, [&](flecs::entity e, const Position &pos, const Team &t) {
-      if (t.team == 1 // hardcoding enemy team
-        && !e.has<ShootDamage>()) // and not a mage
-      {
-        map[pos.y * dd.width + pos.x] = 0.f;
-      }
-    });
-    process_dmap(map, dd);
-  });
+  update_sources_map(sources.dungeon, sources.allies, state, map);
 }
 
-void dmaps::gen_exploration_map(flecs::world &ecs, std::vector<float> &map)
+void dmaps::gen_exploration_map(const DmapSources &sources, ExplorationMapState &state, std::vector<float> &map)
 {
-  static auto tileQuery = ecs.query<const Position, const BackgroundTile, const ExplorationStatus>();
-  query_dungeon_data(ecs, [&](const DungeonData &dd)
+  const DungeonData &dd = sources.dungeon;
+  const DungeonExploration &exploration = sources.exploration;
+  if (exploration.explored.size() * 64 < dd.width * dd.height)
   {
     init_tiles(map, dd);
-    tileQuery.each([&](const Position &pos, const BackgroundTile, const ExplorationStatus &status) {
-      if (!status.explored)
-        map[pos.y * dd.width + pos.x] = 0.f;
-    });
-    process_dmap(map, dd);
-  });
+    return;
+  }
+  const bool sameDungeon = map.size() == dd.width * dd.height && state.solver.dungeonVersion == dd.version;
+  if (sameDungeon && exploration.version == state.version)
+    return;
+  // dirty rects tell only what changed since the previous update, when updates were missed whole map is rebuilt
+  if (!sameDungeon || exploration.version != state.version + 1)
+  {
+    std::vector<Position> unexplored;
+    for (size_t i = 0; i < dd.width * dd.height; ++i)
+      if (!exploration.is_explored(i))
+        unexplored.push_back(Position{int(i % dd.width), int(i / dd.width)});
+    gen_sources_map(dd, unexplored, state.solver, map);
+    state.version = exploration.version;
+    return;
+  }
+  // sources are unexplored cells, so newly explored ones are the only ones removed and none are added
+  std::vector<size_t> removed;
+  for (const DirtyRect &rect : exploration.dirtyRects)
+    for (int y = rect.minY; y <= rect.maxY; ++y)
+      for (int x = rect.minX; x <= rect.maxX; ++x)
+      {
+        const size_t i = y * dd.width + x;
+        if (map[i] == 0.f && exploration.is_explored(i))
+          removed.push_back(i);
+      }
+  std::sort(removed.begin(), removed.end());
+  removed.erase(std::unique(removed.begin(), removed.end()), removed.end());
+  if (!removed.empty())
+    repair_sources_map(dd, removed, {}, map);
+  state.version = exploration.version;
 }
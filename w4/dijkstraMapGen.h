@@ -1,14 +1,52 @@
 #pragma once
 #include <vector>
 #include <flecs.h>
+#include "ecsTypes.h"
 
 namespace dmaps
 {
-  void gen_player_approach_map(flecs::world &ecs, std::vector<float> &map);
-  void gen_player_flee_map(flecs::world &ecs, std::vector<float> &map);
-  void gen_hive_pack_map(flecs::world &ecs, std::vector<float> &map);
-  void gen_mage_map(flecs::world &ecs, std::vector<float> &map);
-  void gen_ally_map(flecs::world &ecs, std::vector<float> &map);
-  void gen_exploration_map(flecs::world &ecs, std::vector<float> &map);
-};
+  // Everything maps are generated from, copied out of the world on the main thread,
+  // so generators don't touch ecs and can run on worker threads
+  struct DmapSources
+  {
+    DungeonData dungeon;
+    bool hasDungeon = false;
+    std::vector<Position> players;
+    std::vector<Position> allies;
+    std::vector<Position> hives;
+    DungeonExploration exploration;
+  };
+
+  void gather_sources(flecs::world &ecs, DmapSources &sources);
+
+  // Dungeon a map was last solved on and whether sweeps gave up on it. Kept per map,
+  // sweeps may round fractional values differently from buckets
+  struct SolverState
+  {
+    uint32_t dungeonVersion = 0;
+    bool twistedDungeon = false;
+  };
 
+  // Sources and dungeon a map was last built for. Maps taking it are repaired only
+  // around sources which appeared or disappeared since then instead of being rebuilt
+  struct SourcesMapState
+  {
+    std::vector<size_t> sources; // sorted tile indices
+    SolverState solver;
+  };
+
+  // Exploration update the map was last built for, only cells explored since then are removed from it
+  struct ExplorationMapState
+  {
+    uint32_t version = 0;
+    SolverState solver;
+  };
+
+  void gen_player_approach_map(const DmapSources &sources, SourcesMapState &state, std::vector<float> &map);
+  void gen_player_flee_map(const DmapSources &sources, const std::vector<float> &approach_map, SolverState &solver,
+                           std::vector<float> &map);
+  void gen_hive_pack_map(const DmapSources &sources, SourcesMapState &state, std::vector<float> &map);
+  void gen_mage_map(const DmapSources &sources, const std::vector<float> &approach_map, std::vector<float> &map);
+  void gen_ally_map(const DmapSources &sources, SourcesMapState &state, std::vector<float> &map);
+  void gen_exploration_map(const DmapSources &sources, ExplorationMapState &state, std::vector<float> &map);
+};
@@ -1,38 +1,91 @@
 #include "ecsTypes.h"
 #include "dmapFollower.h"
 #include <cmath>
+#include <cstdint>
+
+// Transforms of all followers flattened into arrays, so maps are resolved once per call
+// and the evaluation pass doesn't look entities up by name. Buffers are kept between calls
+struct FollowerBatch
+{
+  using Transform = std::function<float(flecs::entity e, float value)>;
+
+  std::vector<std::string> mapNames;
+  std::vector<const DijkstraMapData*> maps;
+  std::vector<flecs::entity> entities;
+  std::vector<size_t> cells;
+  std::vector<Action*> actions;
+  // terms of follower i are [termOffsets[i], termOffsets[i + 1])
+  std::vector<size_t> termOffsets;
+  std::vector<uint8_t> termMaps;
+  std::vector<const Transform*> termTransforms;
+
+  void clear()
+  {
+    mapNames.clear();
+    maps.clear();
+    entities.clear();
+    cells.clear();
+    actions.clear();
+    termOffsets.assign(1, 0);
+    termMaps.clear();
+    termTransforms.clear();
+  }
+
+  uint8_t map_slot(flecs::world &ecs, const std::string &name)
+  {
+    for (size_t i = 0; i < mapNames.size(); ++i)
+      if (mapNames[i] == name)
+        return uint8_t(i);
+    mapNames.push_back(name);
+    maps.push_back(ecs.entity(name.c_str()).get<DijkstraMapData>());
+    return uint8_t(mapNames.size() - 1);
+  }
+};
 
 void process_dmap_followers(flecs::world &ecs, bool processPlayer)
 {
   static auto processDmapFollowers = ecs.query<const Position, Action, const DmapTransform>();
   static auto dungeonDataQuery = ecs.query<const DungeonData>();
+  static FollowerBatch batch;
 
-  auto get_dmap_at = [&](const DijkstraMapData &dmap, const DungeonData &dd, size_t x, size_t y)
-  {
-    return dmap.map[y * dd.width + x];
-  };
   dungeonDataQuery.each([&](const DungeonData &dd)
   {
+    batch.clear();
     processDmapFollowers.each([&](flecs::entity e, const Position& pos, Action &act, const DmapTransform &wt)
     {
       if (e.has<IsPlayer>() != processPlayer)
         return;
       if (e.has<IsPlayer>() && act.action != EA_EXPLORE)
         return;
+      batch.entities.push_back(e);
+      batch.cells.push_back(pos.y * dd.width + pos.x);
+      batch.actions.push_back(&act);
+      for (const auto &pair : wt.transform)
+      {
+        batch.termMaps.push_back(batch.map_slot(ecs, pair.first));
+        batch.termTransforms.push_back(&pair.second);
+      }
+      batch.termOffsets.push_back(batch.termMaps.size());
+    });
+
+    // same order as Actions
+    const ptrdiff_t width = ptrdiff_t(dd.width);
+    const ptrdiff_t moveOffsets[EA_MOVE_END] = {0, -1, 1, width, -width};
+    for (size_t f = 0; f < batch.cells.size(); ++f)
+    {
       float moveWeights[EA_MOVE_END];
       for (size_t i = 0; i < EA_MOVE_END; ++i)
         moveWeights[i] = 0.f;
-      for (const auto &pair : wt.transform)
+      for (size_t t = batch.termOffsets[f]; t < batch.termOffsets[f + 1]; ++t)
       {
-        ecs.entity(pair.first.c_str()).get([&](const DijkstraMapData &dmap)
-        {
-          moveWeights[EA_NOP]         += pair.second(e, get_dmap_at(dmap, dd, pos.x+0, pos.y+0));
-          moveWeights[EA_MOVE_LEFT]   += pair.second(e, get_dmap_at(dmap, dd, pos.x-1, pos.y+0));
-          moveWeights[EA_MOVE_RIGHT]  += pair.second(e, get_dmap_at(dmap, dd, pos.x+1, pos.y+0));
-          moveWeights[EA_MOVE_UP]     += pair.second(e, get_dmap_at(dmap, dd, pos.x+0, pos.y-1));
-          moveWeights[EA_MOVE_DOWN]   += pair.second(e, get_dmap_at(dmap, dd, pos.x+0, pos.y+1));
-        });
+        const DijkstraMapData *dmap = batch.maps[batch.termMaps[t]];
+        if (!dmap || dmap->size() == 0)
+          continue;
+        const FollowerBatch::Transform &transform = *batch.termTransforms[t];
+        for (size_t i = 0; i < EA_MOVE_END; ++i)
+          moveWeights[i] += transform(batch.entities[f], dmap->at(size_t(ptrdiff_t(batch.cells[f]) + moveOffsets[i])));
       }
+      Action &act = *batch.actions[f];
       float minWt = moveWeights[EA_NOP];
       for (size_t i = 0; i < EA_MOVE_END; ++i)
         if (moveWeights[i] < minWt)
@@ -40,7 +93,6 @@ void process_dmap_followers(flecs::world &ecs, bool processPlayer)
           minWt = moveWeights[i];
           act.action = i;
         }
-    });
+    }
   });
 }
-
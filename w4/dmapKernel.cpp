@@ -0,0 +1,231 @@
+#include "dmapKernel.h"
+#include "dungeonUtils.h"
+#include <algorithm>
+#include <limits>
+#include <cstdint>
+#if defined(__AVX__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+constexpr float invalid_tile_value = 1e5f;
+
+// Sources may have any values (flee map scales approach one), a cell goes to bucket floor(value - lowest)
+void dmaps::relax_buckets(std::vector<float> &map, const DungeonData &dd)
+{
+  float lowest = invalid_tile_value;
+  for (size_t i = 0; i < map.size(); ++i)
+    if (dd.tiles[i] == dungeon::floor)
+      lowest = std::min(lowest, map[i]);
+
+  std::vector<std::vector<size_t>> buckets;
+  auto push = [&](size_t i, size_t min_bucket)
+  {
+    // rounding can't move a cell below the bucket it was reached from
+    const size_t bucket = std::max(size_t(map[i] - lowest), min_bucket);
+    if (bucket >= buckets.size())
+      buckets.resize(bucket + 1);
+    buckets[bucket].push_back(i);
+  };
+  for (size_t i = 0; i < map.size(); ++i)
+    if (dd.tiles[i] == dungeon::floor && map[i] < invalid_tile_value)
+      push(i, 0);
+
+  for (size_t bucket = 0; bucket < buckets.size(); ++bucket)
+    for (size_t k = 0; k < buckets[bucket].size(); ++k) // bucket may grow while it's processed
+    {
+      const size_t i = buckets[bucket][k];
+      const size_t x = i % dd.width;
+      const size_t y = i / dd.width;
+      const float val = map[i];
+      auto relax = [&](size_t ni)
+      {
+        if (dd.tiles[ni] == dungeon::floor && val < map[ni] - 1.f)
+        {
+          map[ni] = val + 1.f;
+          push(ni, bucket);
+        }
+      };
+      if (x > 0)
+        relax(i - 1);
+      if (x + 1 < dd.width)
+        relax(i + 1);
+      if (y > 0)
+        relax(i - dd.width);
+      if (y + 1 < dd.height)
+        relax(i + dd.width);
+    }
+}
+
+// row = min(row, from + step), step is 1 for floor and infinity for walls. Returns whether row changed
+static bool relax_row_from(float *row, const float *from, const float *step, size_t width)
+{
+  size_t x = 0;
+#if defined(__AVX__)
+  __m256 changed8 = _mm256_setzero_ps();
+  for (; x + 8 <= width; x += 8)
+  {
+    const __m256 cur = _mm256_loadu_ps(row + x);
+    const __m256 val = _mm256_min_ps(cur, _mm256_add_ps(_mm256_loadu_ps(from + x), _mm256_loadu_ps(step + x)));
+    changed8 = _mm256_or_ps(changed8, _mm256_cmp_ps(val, cur, _CMP_LT_OQ));
+    _mm256_storeu_ps(row + x, val);
+  }
+  bool changed = _mm256_movemask_ps(changed8) != 0;
+#elif defined(__SSE2__) || defined(_M_X64)
+  __m128 changed4 = _mm_setzero_ps();
+  for (; x + 4 <= width; x += 4)
+  {
+    const __m128 cur = _mm_loadu_ps(row + x);
+    const __m128 val = _mm_min_ps(cur, _mm_add_ps(_mm_loadu_ps(from + x), _mm_loadu_ps(step + x)));
+    changed4 = _mm_or_ps(changed4, _mm_cmplt_ps(val, cur));
+    _mm_storeu_ps(row + x, val);
+  }
+  bool changed = _mm_movemask_ps(changed4) != 0;
+#else
+  bool changed = false;
+#endif
+  for (; x < width; ++x)
+  {
+    const float val = from[x] + step[x];
+    if (val < row[x])
+    {
+      row[x] = val;
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+#if defined(__SSE2__) || defined(_M_X64)
+// Shifts lanes up by one or two, lanes shifted in get the bits of fill
+template<int lanes>
+static __m128 shift_up(__m128 v, __m128 fill)
+{
+  return _mm_or_ps(_mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(v), lanes * 4)), fill);
+}
+
+template<int lanes>
+static __m128 shift_down(__m128 v, __m128 fill)
+{
+  return _mm_or_ps(_mm_castsi128_ps(_mm_srli_si128(_mm_castps_si128(v), lanes * 4)), fill);
+}
+#endif
+
+// Left to right and right to left passes inside of a row. Every cell depends on the previous one,
+// so vector version scans 4 cells at once in two steps of doubling length (min-plus prefix scan)
+// and carries the result into the next 4 cells through the sum of steps leading to each of them
+static bool relax_row_along(float *row, const float *step, size_t width)
+{
+  bool changed = false;
+  size_t x = 1;
+#if defined(__SSE2__) || defined(_M_X64)
+  const float inf = std::numeric_limits<float>::infinity();
+  // lanes shifted in from outside of the block, _mm_set_ps takes lanes from the last one
+  const __m128 infLow1 = _mm_set_ps(0.f, 0.f, 0.f, inf);
+  const __m128 infLow2 = _mm_set_ps(0.f, 0.f, inf, inf);
+  const __m128 infHigh1 = _mm_set_ps(inf, 0.f, 0.f, 0.f);
+  const __m128 infHigh2 = _mm_set_ps(inf, inf, 0.f, 0.f);
+  const __m128 zero = _mm_setzero_ps();
+  __m128 changed4 = zero;
+
+  __m128 carry = _mm_set1_ps(row[0]);
+  for (; x + 4 <= width; x += 4)
+  {
+    const __m128 cur = _mm_loadu_ps(row + x);
+    __m128 cost = _mm_loadu_ps(step + x); // cost of reaching lane from one lane before
+    __m128 val = _mm_min_ps(cur, _mm_add_ps(shift_up<1>(cur, infLow1), cost));
+    cost = _mm_add_ps(cost, shift_up<1>(cost, zero));
+    val = _mm_min_ps(val, _mm_add_ps(shift_up<2>(val, infLow2), cost));
+    cost = _mm_add_ps(cost, shift_up<2>(cost, zero)); // now cost from the cell before this block
+    val = _mm_min_ps(val, _mm_add_ps(carry, cost));
+    changed4 = _mm_or_ps(changed4, _mm_cmplt_ps(val, cur));
+    _mm_storeu_ps(row + x, val);
+    carry = _mm_shuffle_ps(val, val, _MM_SHUFFLE(3, 3, 3, 3));
+  }
+#endif
+  for (; x < width; ++x)
+  {
+    const float val = row[x - 1] + step[x];
+    if (val < row[x])
+    {
+      row[x] = val;
+      changed = true;
+    }
+  }
+
+  // going back step of a cell is the cost of leaving it, it's the same as entering next one
+  size_t end = width - 1;
+#if defined(__SSE2__) || defined(_M_X64)
+  carry = _mm_set1_ps(row[width - 1]);
+  for (; end >= 4; end -= 4)
+  {
+    const size_t from = end - 4;
+    const __m128 cur = _mm_loadu_ps(row + from);
+    __m128 cost = _mm_loadu_ps(step + from);
+    __m128 val = _mm_min_ps(cur, _mm_add_ps(shift_down<1>(cur, infHigh1), cost));
+    cost = _mm_add_ps(cost, shift_down<1>(cost, zero));
+    val = _mm_min_ps(val, _mm_add_ps(shift_down<2>(val, infHigh2), cost));
+    cost = _mm_add_ps(cost, shift_down<2>(cost, zero));
+    val = _mm_min_ps(val, _mm_add_ps(carry, cost));
+    changed4 = _mm_or_ps(changed4, _mm_cmplt_ps(val, cur));
+    _mm_storeu_ps(row + from, val);
+    carry = _mm_shuffle_ps(val, val, _MM_SHUFFLE(0, 0, 0, 0));
+  }
+  changed |= _mm_movemask_ps(changed4) != 0;
+#endif
+  for (; end > 0; --end)
+  {
+    const float val = row[end] + step[end - 1];
+    if (val < row[end - 1])
+    {
+      row[end - 1] = val;
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+bool dmaps::relax_sweeps(std::vector<float> &map, const DungeonData &dd, size_t max_iterations)
+{
+  if (dd.width == 0 || dd.height == 0)
+    return true;
+  // walls are infinitely far and can't be entered, so the kernel doesn't have to look at tiles
+  constexpr float wall = std::numeric_limits<float>::infinity();
+  static thread_local std::vector<float> dist;
+  static thread_local std::vector<float> step;
+  dist.resize(map.size());
+  step.resize(map.size());
+  for (size_t i = 0; i < map.size(); ++i)
+  {
+    const bool isFloor = dd.tiles[i] == dungeon::floor;
+    dist[i] = isFloor ? map[i] : wall;
+    step[i] = isFloor ? 1.f : wall;
+  }
+
+  const size_t w = dd.width;
+  // rows which were relaxed along and didn't change since don't need it again,
+  // so the last sweeps, which only confirm that nothing changes, are vertical passes
+  static thread_local std::vector<uint8_t> settled;
+  settled.assign(dd.height, 0);
+  bool changed = true;
+  auto relax_along = [&](size_t y, bool row_changed)
+  {
+    if (!row_changed && settled[y])
+      return;
+    changed |= relax_row_along(&dist[y * w], &step[y * w], w) || row_changed;
+    settled[y] = 1;
+  };
+  for (size_t iteration = 0; changed && iteration < max_iterations; ++iteration)
+  {
+    changed = false;
+    relax_along(0, false);
+    for (size_t y = 1; y < dd.height; ++y)
+      relax_along(y, relax_row_from(&dist[y * w], &dist[(y - 1) * w], &step[y * w], w));
+    for (size_t y = dd.height - 1; y > 0; --y)
+      relax_along(y - 1, relax_row_from(&dist[(y - 1) * w], &dist[y * w], &step[(y - 1) * w], w));
+  }
+
+  for (size_t i = 0; i < map.size(); ++i)
+    if (dd.tiles[i] == dungeon::floor)
+      map[i] = dist[i];
+  return !changed;
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include <vector>
+#include "ecsTypes.h"
+
+// Solvers for Dijkstra maps: every floor cell ends up with min(its own value, neighbour value + 1),
+// walls and cells outside of the map don't take part. Both produce bit-identical maps from whole-valued
+// sources; from fractional ones (flee maps) sweeps add summed steps, so results may differ by rounding.
+namespace dmaps
+{
+  // Dial's algorithm: cells are settled bucket by bucket of their distance from the lowest source.
+  // Touches every cell a constant number of times, regardless of how twisted the dungeon is
+  void relax_buckets(std::vector<float> &map, const DungeonData &dd);
+
+  // Down and up sweeps over rows until nothing changes: each row takes min-plus of the row
+  // next to it in vector registers (AVX, SSE or scalar fallback), then is relaxed left and right.
+  // Every sweep is a straight pass over memory, but number of sweeps grows with path turns.
+  // Stops after max_iterations pairs of sweeps and returns false if map wasn't done by then,
+  // values are still valid distances along some paths, so relax_buckets can finish it
+  bool relax_sweeps(std::vector<float> &map, const DungeonData &dd, size_t max_iterations = ~size_t(0));
+};
@@ -0,0 +1,155 @@
+#include "dmapPipeline.h"
+#include <algorithm>
+#include <cstring>
+
+std::vector<DmapPipeline::Stage> DmapPipeline::make_stages(std::vector<DmapDesc> &descs)
+{
+  std::vector<Stage> result(descs.size());
+  for (size_t i = 0; i < descs.size(); ++i)
+    result[i].desc = std::move(descs[i]);
+  return result;
+}
+
+DmapPipeline::DmapPipeline(std::vector<DmapDesc> descs)
+  : stages(make_stages(descs))
+  , waves(build_waves(stages))
+  , pool(std::max(std::min(widest_wave(waves), size_t(std::thread::hardware_concurrency())), size_t(1)))
+  , service([this]() { service_loop(); })
+{
+}
+
+DmapPipeline::~DmapPipeline()
+{
+  {
+    std::lock_guard<std::mutex> lock(serviceMutex);
+    stop = true;
+  }
+  submitCv.notify_all();
+  service.join();
+}
+
+std::vector<std::vector<size_t>> DmapPipeline::build_waves(std::vector<Stage> &in_stages)
+{
+  // map goes into the wave right after the latest of its dependencies,
+  // only maps declared earlier can be depended on, so there are no cycles
+  std::vector<size_t> waveOf(in_stages.size(), 0);
+  std::vector<std::vector<size_t>> result;
+  for (size_t i = 0; i < in_stages.size(); ++i)
+  {
+    Stage &stage = in_stages[i];
+    for (const char *depName : stage.desc.deps)
+      for (size_t j = 0; j < i; ++j)
+        if (strcmp(in_stages[j].desc.name, depName) == 0)
+        {
+          stage.deps.push_back(j);
+          waveOf[i] = std::max(waveOf[i], waveOf[j] + 1);
+          break;
+        }
+    stage.depMaps.resize(stage.deps.size());
+    if (waveOf[i] >= result.size())
+      result.resize(waveOf[i] + 1);
+    result[waveOf[i]].push_back(i);
+  }
+  return result;
+}
+
+size_t DmapPipeline::widest_wave(const std::vector<std::vector<size_t>> &in_waves)
+{
+  size_t widest = 0;
+  for (const std::vector<size_t> &wave : in_waves)
+    widest = std::max(widest, wave.size());
+  return widest;
+}
+
+void DmapPipeline::submit(flecs::world &ecs)
+{
+  // service thread reads sources and back buffers, so they are free only after it's done
+  wait();
+  dmaps::gather_sources(ecs, sources);
+  for (Stage &stage : stages)
+    if (!stage.entity)
+      stage.entity = ecs.entity(stage.desc.name);
+  {
+    std::lock_guard<std::mutex> lock(serviceMutex);
+    submitted = true;
+  }
+  inFlight = true;
+  submitCv.notify_one();
+}
+
+bool DmapPipeline::poll()
+{
+  if (!inFlight || !ready.load(std::memory_order_acquire))
+    return false;
+  publish();
+  return true;
+}
+
+void DmapPipeline::wait()
+{
+  if (!inFlight)
+    return;
+  {
+    std::unique_lock<std::mutex> lock(serviceMutex);
+    readyCv.wait(lock, [this]() { return ready.load(std::memory_order_acquire); });
+  }
+  publish();
+}
+
+void DmapPipeline::service_loop()
+{
+  while (true)
+  {
+    {
+      std::unique_lock<std::mutex> lock(serviceMutex);
+      submitCv.wait(lock, [this]() { return stop || submitted; });
+      // submitted maps are finished even when stopping, nobody waits for them though
+      if (!submitted)
+        return;
+      submitted = false;
+    }
+    generate();
+    {
+      std::lock_guard<std::mutex> lock(serviceMutex);
+      ready.store(true, std::memory_order_release);
+    }
+    readyCv.notify_all();
+  }
+}
+
+void DmapPipeline::generate()
+{
+  for (const std::vector<size_t> &wave : waves)
+    pool.parallel_for(wave.size(), [&](size_t i)
+    {
+      Stage &stage = stages[wave[i]];
+      if (!sources.hasDungeon)
+      {
+        stage.values.clear();
+        stage.data.store(stage.values, stage.desc.storage);
+        return;
+      }
+      for (size_t d = 0; d < stage.deps.size(); ++d)
+        stage.depMaps[d] = &stages[stage.deps[d]].values;
+      stage.desc.generate(sources, stage.depMaps, stage.values);
+      stage.data.store(stage.values, stage.desc.storage);
+    });
+}
+
+void DmapPipeline::publish()
+{
+  inFlight = false;
+  ready.store(false, std::memory_order_relaxed);
+  for (Stage &stage : stages)
+  {
+    // swapping leaves previous front in the back buffer, next store reuses its storage
+    bool swapped = false;
+    stage.entity.get([&](DijkstraMapData &front)
+    {
+      std::swap(front, stage.data);
+      swapped = true;
+    });
+    if (!swapped)
+      stage.entity.set(stage.data);
+  }
+}
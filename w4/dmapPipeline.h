@@ -0,0 +1,83 @@
+#pragma once
+#include <vector>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <flecs.h>
+#include "ecsTypes.h"
+#include "dijkstraMapGen.h"
+#include "threadPool.h"
+
+// Generator gets maps it depends on in the order they were declared
+using DmapGenerator = std::function<void(const dmaps::DmapSources &sources,
+                                         const std::vector<const std::vector<float>*> &deps,
+                                         std::vector<float> &map)>;
+
+struct DmapDesc
+{
+  const char *name;
+  std::vector<const char*> deps; // names of maps declared earlier
+  DmapStorage storage; // how the map is published, generators and dependants always see floats
+  DmapGenerator generate;
+};
+
+// Builds all declared dmaps once per turn. Maps are split into waves by their dependencies
+// and maps of the same wave are generated in parallel, so a turn takes as long as
+// the slowest map of each wave instead of all of them together.
+// Generation runs on a service thread into back buffers, while entities named after maps
+// keep the front ones. All maps of a turn are swapped into entities together on the main thread,
+// so readers never see maps of different turns mixed.
+class DmapPipeline
+{
+public:
+  explicit DmapPipeline(std::vector<DmapDesc> descs);
+  ~DmapPipeline();
+
+  DmapPipeline(const DmapPipeline &) = delete;
+  DmapPipeline &operator=(const DmapPipeline &) = delete;
+
+  // Gathers sources and starts generating maps on the service thread.
+  // Maps still being generated from the previous submit are waited for and published first
+  void submit(flecs::world &ecs);
+  // Publishes submitted maps if they are ready, never blocks
+  bool poll();
+  // Blocks until submitted maps are ready and publishes them, returns at once if nothing was submitted
+  void wait();
+
+  void run(flecs::world &ecs) { submit(ecs); wait(); }
+
+private:
+  struct Stage
+  {
+    DmapDesc desc;
+    std::vector<size_t> deps;
+    std::vector<const std::vector<float>*> depMaps;
+    std::vector<float> values;
+    DijkstraMapData data; // back buffer, holds previous front after publishing
+    flecs::entity entity;
+  };
+
+  static std::vector<Stage> make_stages(std::vector<DmapDesc> &descs);
+  static std::vector<std::vector<size_t>> build_waves(std::vector<Stage> &in_stages);
+  static size_t widest_wave(const std::vector<std::vector<size_t>> &in_waves);
+
+  void service_loop();
+  void generate();
+  void publish();
+
+  std::vector<Stage> stages;
+  std::vector<std::vector<size_t>> waves;
+  dmaps::DmapSources sources;
+  ThreadPool pool;
+
+  std::mutex serviceMutex;
+  std::condition_variable submitCv;
+  std::condition_variable readyCv;
+  bool submitted = false;
+  bool stop = false;
+  std::atomic<bool> ready = false;
+  bool inFlight = false; // touched by main thread only
+  std::thread service;
+};
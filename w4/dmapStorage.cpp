@@ -0,0 +1,52 @@
+#include "ecsTypes.h"
+#include <algorithm>
+#include <cmath>
+
+void DijkstraMapData::store(const std::vector<float> &values, DmapStorage in_storage)
+{
+  storage = in_storage;
+  if (storage == DmapStorage::Float)
+  {
+    map = values;
+    fixed16.clear();
+    saturated8.clear();
+    offset = 0.f;
+    step = 1.f;
+    return;
+  }
+  map.clear();
+
+  float lowest = invalid_value;
+  float highest = -invalid_value;
+  for (float v : values)
+    if (v < invalid_value)
+    {
+      lowest = std::min(lowest, v);
+      highest = std::max(highest, v);
+    }
+  offset = lowest < invalid_value ? lowest : 0.f;
+
+  if (storage == DmapStorage::Saturated8)
+  {
+    fixed16.clear();
+    step = 1.f;
+    saturated8.resize(values.size());
+    for (size_t i = 0; i < values.size(); ++i)
+      saturated8[i] = values[i] < invalid_value
+        ? uint8_t(std::min(std::lround(values[i] - offset), long(invalid_saturated8 - 1)))
+        : invalid_saturated8;
+    return;
+  }
+
+  saturated8.clear();
+  // finest power of two step which still fits the whole range, steps finer than 1/256 aren't needed
+  const float range = lowest < invalid_value ? highest - offset : 0.f;
+  step = 1.f / 256.f;
+  while (range / step > float(invalid_fixed16 - 1))
+    step *= 2.f;
+  fixed16.resize(values.size());
+  for (size_t i = 0; i < values.size(); ++i)
+    fixed16[i] = values[i] < invalid_value
+      ? uint16_t(std::min(std::lround((values[i] - offset) / step), long(invalid_fixed16 - 1)))
+      : invalid_fixed16;
+}
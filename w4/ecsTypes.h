@@ -4,6 +4,7 @@
 #include <vector>
 #include <unordered_map>
 #include <functional>
+#include <cstdint>
 #include <flecs.h>
 
 // TODO: make a lot of seprate files
@@ -155,11 +156,51 @@ struct DungeonData
   std::vector<char> tiles; // for pathfinding
   size_t width;
   size_t height;
+  uint32_t version = 0; // new for every set of tiles, so users can tell the dungeon changed without comparing them
+};
+
+// How map values are kept. Packed storages take less memory and cache per map,
+// all of them are read with DijkstraMapData::at
+enum class DmapStorage : uint8_t
+{
+  Float,
+  Fixed16, // fixed point with power of two step, exact for step counts
+  Saturated8, // whole steps, cells farther than 254 steps from the closest one read as 254 steps away
 };
 
 struct DijkstraMapData
 {
-  std::vector<float> map;
+  static constexpr float invalid_value = 1e5f; // walls and unreachable cells
+  static constexpr uint16_t invalid_fixed16 = 0xffff;
+  static constexpr uint8_t invalid_saturated8 = 0xff;
+
+  std::vector<float> map; // Float storage
+  std::vector<uint16_t> fixed16;
+  std::vector<uint8_t> saturated8;
+  DmapStorage storage = DmapStorage::Float;
+  float offset = 0.f; // value of the lowest packed cell
+  float step = 1.f; // value difference between neighbouring packed values
+
+  float at(size_t idx) const
+  {
+    if (storage == DmapStorage::Fixed16)
+      return fixed16[idx] == invalid_fixed16 ? invalid_value : offset + float(fixed16[idx]) * step;
+    if (storage == DmapStorage::Saturated8)
+      return saturated8[idx] == invalid_saturated8 ? invalid_value : offset + float(saturated8[idx]) * step;
+    return map[idx];
+  }
+
+  size_t size() const
+  {
+    if (storage == DmapStorage::Fixed16)
+      return fixed16.size();
+    if (storage == DmapStorage::Saturated8)
+      return saturated8.size();
+    return map.size();
+  }
+
+  // Converts values into the given storage, buffers of other storages are cleared
+  void store(const std::vector<float> &values, DmapStorage in_storage);
 };
 
 struct VisualiseMap {};
@@ -175,3 +216,22 @@ struct ExplorationStatus
 {
   bool explored = false;
 };
+
+// Inclusive bounds of cells
+struct DirtyRect
+{
+  int minX, minY;
+  int maxX, maxY;
+};
+
+// Exploration status of every cell of the dungeon, kept on the same entity as DungeonData.
+// Walls count as explored, there's nothing to find in them
+struct DungeonExploration
+{
+  std::vector<uint64_t> explored;
+  std::vector<DirtyRect> dirtyRects; // around cells explored on the last update
+  uint32_t version = 0; // bumped on every update, rects only tell what changed since the previous one
+
+  bool is_explored(size_t idx) const { return (explored[idx / 64] >> (idx % 64)) & 1; }
+  void explore(size_t idx) { explored[idx / 64] |= uint64_t(1) << (idx % 64); }
+};
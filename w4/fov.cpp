@@ -0,0 +1,99 @@
+#include "fov.h"
+#include "dungeonUtils.h"
+
+void fov::VisibilityMap::reset(size_t width, size_t height)
+{
+  if (numCells != width * height)
+  {
+    numCells = width * height;
+    bits.assign((numCells + 63) / 64, 0);
+    litCells.clear();
+    return;
+  }
+  for (size_t idx : litCells)
+    bits[idx / 64] = 0;
+  litCells.clear();
+}
+
+// Transforms octant coordinates (col, row) into map offsets
+struct Octant
+{
+  int xx, xy, yx, yy;
+};
+
+static constexpr Octant octants[8] = {
+  { 1,  0,  0,  1}, { 0,  1,  1,  0}, { 0, -1,  1,  0}, {-1,  0,  0,  1},
+  {-1,  0,  0, -1}, { 0, -1, -1,  0}, { 0,  1, -1,  0}, { 1,  0,  0, -1}
+};
+
+struct Caster
+{
+  const DungeonData &dd;
+  fov::VisibilityMap &visibility;
+  int originX;
+  int originY;
+  int radius;
+
+  bool is_opaque(int x, int y) const
+  {
+    return x < 0 || y < 0 || x >= int(dd.width) || y >= int(dd.height) || dd.tiles[size_t(y) * dd.width + size_t(x)] == dungeon::wall;
+  }
+
+  // Scans rows of octant starting from row, between slopes start (higher) and end (lower).
+  // Walls split the scanned sector, part before the wall continues on the next row recursively
+  void cast(int row, float start, float end, const Octant &oct)
+  {
+    if (start < end)
+      return;
+    float nextStart = start;
+    for (int dist = row; dist < radius; ++dist)
+    {
+      bool blocked = false;
+      for (int dx = -dist; dx <= 0; ++dx)
+      {
+        const int dy = -dist;
+        const float leftSlope = (float(dx) - 0.5f) / (float(dy) + 0.5f);
+        const float rightSlope = (float(dx) + 0.5f) / (float(dy) - 0.5f);
+        if (start < rightSlope)
+          continue;
+        if (end > leftSlope)
+          break;
+
+        const int x = originX + dx * oct.xx + dy * oct.xy;
+        const int y = originY + dx * oct.yx + dy * oct.yy;
+        const bool opaque = is_opaque(x, y);
+        if (!(x < 0 || y < 0 || x >= int(dd.width) || y >= int(dd.height)) && dx * dx + dy * dy < radius * radius)
+          visibility.light(size_t(y) * dd.width + size_t(x));
+
+        if (blocked)
+        {
+          if (opaque)
+          {
+            nextStart = rightSlope;
+            continue;
+          }
+          blocked = false;
+          start = nextStart;
+        }
+        else if (opaque && dist + 1 < radius)
+        {
+          blocked = true;
+          cast(dist + 1, start, leftSlope, oct);
+          nextStart = rightSlope;
+        }
+      }
+      if (blocked)
+        break;
+    }
+  }
+};
+
+void fov::compute(const DungeonData &dd, const Position &origin, int radius, VisibilityMap &visibility)
+{
+  if (origin.x < 0 || origin.y < 0 || origin.x >= int(dd.width) || origin.y >= int(dd.height) || radius <= 0)
+    return;
+  visibility.light(size_t(origin.y) * dd.width + size_t(origin.x));
+  Caster caster{dd, visibility, origin.x, origin.y, radius};
+  for (const Octant &oct : octants)
+    caster.cast(1, 1.f, 0.f, oct);
+}
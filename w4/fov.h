@@ -0,0 +1,38 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include "ecsTypes.h"
+
+namespace fov
+{
+  // Bitmap of visible cells. Remembers which cells were lit,
+  // so clearing it costs as much as the last field of view, not the whole map
+  class VisibilityMap
+  {
+  public:
+    void reset(size_t width, size_t height);
+
+    bool is_visible(size_t idx) const { return (bits[idx / 64] >> (idx % 64)) & 1; }
+    const std::vector<size_t> &lit_cells() const { return litCells; }
+
+    void light(size_t idx)
+    {
+      uint64_t &word = bits[idx / 64];
+      const uint64_t mask = uint64_t(1) << (idx % 64);
+      if (word & mask)
+        return;
+      word |= mask;
+      litCells.push_back(idx);
+    }
+
+  private:
+    size_t numCells = 0;
+    std::vector<uint64_t> bits;
+    std::vector<size_t> litCells;
+  };
+
+  // Recursive shadowcasting: lights cells closer than radius to origin which aren't hidden by walls.
+  // Walls themselves are lit. Only cells inside of the radius are ever looked at,
+  // several calls on the same map add up fields of view of several viewers
+  void compute(const DungeonData &dd, const Position &origin, int radius, VisibilityMap &visibility);
+};
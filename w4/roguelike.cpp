@@ -7,7 +7,9 @@
 #include "math.h"
 #include "dungeonUtils.h"
 #include "dijkstraMapGen.h"
+#include "dmapPipeline.h"
 #include "dmapFollower.h"
+#include "fov.h"
 
 static flecs::entity create_player_approacher(flecs::entity e)
 {
@@ -321,7 +323,7 @@ static void register_roguelike_systems(flecs::world &ecs)
             {
               ecs.entity(pair.first.c_str()).get([&](const DijkstraMapData &dmap)
               {
-                float v = dmap.map[y * dd.width + x];
+                float v = dmap.at(y * dd.width + x);
                 sum += pair.second(e, v);
               });
             }
@@ -340,7 +342,7 @@ static void register_roguelike_systems(flecs::world &ecs)
         for (size_t y = 0; y < dd.height; ++y)
           for (size_t x = 0; x < dd.width; ++x)
           {
-            const float val = dmap.map[y * dd.width + x];
+            const float val = dmap.at(y * dd.width + x);
             if (val < 1e5f)
               DrawText(TextFormat("%.1f", val),
                   (float(x) + 0.2f) * tile_size, (float(y) + 0.5f) * tile_size, 150, WHITE);
@@ -394,8 +396,15 @@ void init_dungeon(flecs::world &ecs, char *tiles, size_t w, size_t h)
   for (size_t y = 0; y < h; ++y)
     for (size_t x = 0; x < w; ++x)
       dungeonData[y * w + x] = tiles[y * w + x];
+  DungeonExploration exploration;
+  exploration.explored.assign((w * h + 63) / 64, 0);
+  for (size_t i = 0; i < w * h; ++i)
+    if (tiles[i] != dungeon::floor)
+      exploration.explore(i);
+  static uint32_t dungeonVersion = 0;
   ecs.entity("dungeon")
-    .set(DungeonData{dungeonData, w, h});
+    .set(DungeonData{dungeonData, w, h, ++dungeonVersion})
+    .set(exploration);
 
   for (size_t y = 0; y < h; ++y)
     for (size_t x = 0; x < w; ++x)
@@ -460,6 +469,9 @@ static void push_to_log(flecs::world &ecs, const char *msg)
   });
 }
 
+// player explores floor it can see closer than this many tiles
+constexpr int exploration_radius = 2;
+
 static void process_actions(flecs::world &ecs)
 {
   static auto processActions = ecs.query<Action, Position, MovePos, const MeleeDamage, const Team>();
@@ -481,7 +493,7 @@ static void process_actions(flecs::world &ecs)
       checkShots.each([&](Hitpoints &hp, const Team &enemy_team) {
         float mageMapValue = 1e5f;
         ecs.entity("mage_map").get([&](const DijkstraMapData &dmap) {
-          mageMapValue = dmap.map[pos.y * dungeonWidth + pos.x];
+          mageMapValue = dmap.at(pos.y * dungeonWidth + pos.x);
         });
         if (team.team != enemy_team.team && mageMapValue == 0.f)
         // Mage still shoots at us even when runnung away
@@ -526,11 +538,41 @@ static void process_actions(flecs::world &ecs)
     });
 
     // Dungeon exploration
-    dungeonExploration.each([&](const IsPlayer &, const Position &ppos)
+    ecs.entity("dungeon").get([&](const DungeonData &dd, DungeonExploration &exploration)
     {
-      checkTiles.each([&](flecs::entity e, const BackgroundTile &, const Position &tpos, ExplorationStatus &status) {
-        if (dist_sq(ppos, tpos) < 4.f)
-          status.explored = true;
+      // floor tile entity of every cell, so tiles in view are found without going over all of them
+      static std::vector<flecs::entity> floorTiles;
+      if (floorTiles.size() != dd.width * dd.height)
+      {
+        floorTiles.assign(dd.width * dd.height, flecs::entity());
+        checkTiles.each([&](flecs::entity e, const BackgroundTile &, const Position &tpos, ExplorationStatus &)
+        {
+          floorTiles[tpos.y * dd.width + tpos.x] = e;
+        });
+      }
+      exploration.dirtyRects.clear();
+      ++exploration.version;
+      static fov::VisibilityMap explorationView;
+      dungeonExploration.each([&](const IsPlayer &, const Position &ppos)
+      {
+        explorationView.reset(dd.width, dd.height);
+        fov::compute(dd, ppos, exploration_radius, explorationView);
+        DirtyRect rect{ppos.x, ppos.y, ppos.x, ppos.y};
+        bool exploredAny = false;
+        for (size_t i : explorationView.lit_cells())
+        {
+          if (exploration.is_explored(i))
+            continue;
+          exploration.explore(i);
+          if (floorTiles[i])
+            floorTiles[i].set(ExplorationStatus{true});
+          const int x = int(i % dd.width);
+          const int y = int(i / dd.width);
+          rect = {std::min(rect.minX, x), std::min(rect.minY, y), std::max(rect.maxX, x), std::max(rect.maxY, y)};
+          exploredAny = true;
+        }
+        if (exploredAny)
+          exploration.dirtyRects.push_back(rect);
       });
     });
   });
@@ -611,6 +653,32 @@ static void gather_world_info(flecs::world &ecs)
   });
 }
 
+static DmapPipeline &dmap_pipeline()
+{
+  // flee map isn't made of whole steps, others are packed without losing anything
+  static DmapPipeline pipeline({
+    {"approach_map", {}, DmapStorage::Fixed16,
+      [state = dmaps::SourcesMapState()](const dmaps::DmapSources &s, const auto &, std::vector<float> &map) mutable
+      { dmaps::gen_player_approach_map(s, state, map); }},
+    {"flee_map", {"approach_map"}, DmapStorage::Float,
+      [solver = dmaps::SolverState()](const dmaps::DmapSources &s, const auto &deps, std::vector<float> &map) mutable
+      { dmaps::gen_player_flee_map(s, *deps[0], solver, map); }},
+    {"hive_map", {}, DmapStorage::Fixed16,
+      [state = dmaps::SourcesMapState()](const dmaps::DmapSources &s, const auto &, std::vector<float> &map) mutable
+      { dmaps::gen_hive_pack_map(s, state, map); }},
+    {"mage_map", {"approach_map"}, DmapStorage::Fixed16,
+      [](const dmaps::DmapSources &s, const auto &deps, std::vector<float> &map)
+      { dmaps::gen_mage_map(s, *deps[0], map); }},
+    {"ally_map", {}, DmapStorage::Fixed16,
+      [state = dmaps::SourcesMapState()](const dmaps::DmapSources &s, const auto &, std::vector<float> &map) mutable
+      { dmaps::gen_ally_map(s, state, map); }},
+    {"exploration_map", {}, DmapStorage::Fixed16,
+      [state = dmaps::ExplorationMapState()](const dmaps::DmapSources &s, const auto &, std::vector<float> &map) mutable
+      { dmaps::gen_exploration_map(s, state, map); }},
+  });
+  return pipeline;
+}
+
 void process_turn(flecs::world &ecs)
 {
   static auto stateMachineAct = ecs.query<StateMachine>();
@@ -618,6 +686,8 @@ void process_turn(flecs::world &ecs)
   static auto turnIncrementer = ecs.query<TurnCounter>();
   if (is_player_acted(ecs))
   {
+    // turn is decided by maps of the previous one, so they have to be there
+    dmap_pipeline().wait();
     if (upd_player_actions_count(ecs))
     {
       // Plan action for NPCs
@@ -639,39 +709,14 @@ void process_turn(flecs::world &ecs)
     process_dmap_followers(ecs, true);
     process_actions(ecs);
 
-    std::vector<float> approachMap;
-    dmaps::gen_player_approach_map(ecs, approachMap);
-    ecs.entity("approach_map")
-      .set(DijkstraMapData{approachMap});
-
-    std::vector<float> fleeMap;
-    dmaps::gen_player_flee_map(ecs, fleeMap);
-    ecs.entity("flee_map")
-      .set(DijkstraMapData{fleeMap});
-
-    std::vector<float> hiveMap;
-    dmaps::gen_hive_pack_map(ecs, hiveMap);
-    ecs.entity("hive_map")
-      .set(DijkstraMapData{hiveMap});
-
-    std::vector<float> mageMap;
-    dmaps::gen_mage_map(ecs, mageMap);
-    ecs.entity("mage_map")
-      .set(DijkstraMapData{mageMap})
-      .add<VisualiseMap>();
-
-    std::vector<float> allyMap;
-    dmaps::gen_ally_map(ecs, allyMap);
-    ecs.entity("ally_map")
-      .set(DijkstraMapData{allyMap});
-
-    std::vector<float> explorationMap;
-    dmaps::gen_exploration_map(ecs, explorationMap);
-    ecs.entity("exploration_map")
-      .set(DijkstraMapData{explorationMap});
+    // maps are generated while frames before the next turn are drawn
+    dmap_pipeline().submit(ecs);
+    ecs.entity("mage_map").add<VisualiseMap>();
 
     //ecs.entity("flee_map").add<VisualiseMap>();
   }
+  else
+    dmap_pipeline().poll();
 }
 
 void print_stats(flecs::world &ecs)
@@ -0,0 +1,50 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+// Fixed set of workers with a task deque each. Workers take tasks from the front
+// of their own deque and steal from the back of others' when they run out,
+// so uneven tasks (like maps of different cost) get balanced automatically.
+class ThreadPool
+{
+public:
+  // Calling thread participates in parallel_for, so num_threads - 1 threads are spawned
+  explicit ThreadPool(size_t num_threads = std::thread::hardware_concurrency());
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  size_t size() const { return workers.size(); }
+
+  // Runs job(i) for every i in [0, count) and waits for all of them to finish
+  void parallel_for(size_t count, const std::function<void(size_t)> &job);
+
+private:
+  struct Worker
+  {
+    std::mutex mutex;
+    std::deque<size_t> tasks;
+  };
+
+  void worker_loop(size_t worker_idx);
+  void run_tasks(size_t worker_idx);
+  bool pop_task(size_t worker_idx, size_t &task);
+
+  std::vector<Worker> workers;
+  std::vector<std::thread> threads;
+
+  std::mutex batchMutex;
+  std::condition_variable batchCv;
+  std::condition_variable doneCv;
+  size_t batch = 0;
+  bool stop = false;
+
+  const std::function<void(size_t)> *job = nullptr;
+  std::atomic<size_t> remaining = 0;
+};
@@ -1,6 +1,7 @@
 #include "dijkstraMapGen.h"
 #include "ecsTypes.h"
 #include "dungeonUtils.h"
+#include "dmapKernel.h"
 
 template<typename Callable>
 static void query_dungeon_data(flecs::world &ecs, Callable c)
@@ -27,82 +28,72 @@ static void init_tiles(std::vector<float> &map, const DungeonData &dd)
     v = invalid_tile_value;
 }
 
-// scan version, could be implemented as Dijkstra version as well
-static void process_dmap(std::vector<float> &map, const DungeonData &dd)
+// Sweeps are faster on open dungeons, where paths turn only a few times, and buckets on twisted ones.
+// When sweeps don't converge quickly they aren't tried for this map until its dungeon changes
+static void process_dmap(std::vector<float> &map, const DungeonData &dd, dmaps::SolverState &solver)
 {
-  bool done = false;
-  auto getMapAt = [&](size_t x, size_t y, float def)
+  if (solver.dungeonVersion != dd.version)
   {
-    if (x < dd.width && y < dd.width && dd.tiles[y * dd.width + x] == dungeon::floor)
-      return map[y * dd.width + x];
-    return def;
-  };
-  auto getMinNei = [&](size_t x, size_t y)
-  {
-    float val = map[y * dd.width + x];
-    val = std::min(val, getMapAt(x - 1, y + 0, val));
-    val = std::min(val, getMapAt(x + 1, y + 0, val));
-    val = std::min(val, getMapAt(x + 0, y - 1, val));
-    val = std::min(val, getMapAt(x + 0, y + 1, val));
-    return val;
-  };
-  while (!done)
+    solver.dungeonVersion = dd.version;
+    solver.twistedDungeon = false;
+  }
+  if (solver.twistedDungeon || !dmaps::relax_sweeps(map, dd, 4))
   {
-    done = true;
-    for (size_t y = 0; y < dd.height; ++y)
-      for (size_t x = 0; x < dd.width; ++x)
-      {
-        const size_t i = y * dd.width + x;
-        if (dd.tiles[i] != dungeon::floor)
-          continue;
-        const float myVal = getMapAt(x, y, invalid_tile_value);
-        const float minVal = getMinNei(x, y);
-        if (minVal < myVal - 1.f)
-        {
-          map[i] = minVal + 1.f;
-          done = false;
-        }
-      }
+    solver.twistedDungeon = true;
+    dmaps::relax_buckets(map, dd);
   }
 }
 
-void dmaps::gen_player_approach_map(flecs::world &ecs, std::vector<float> &map)
+void dmaps::gather_sources(flecs::world &ecs, DmapSources &sources)
 {
+  static auto hiveQuery = ecs.query<const Position, const Hive>();
+
+  sources.hasDungeon = false;
+  // sources are kept between turns, dungeon is copied only when it changed
   query_dungeon_data(ecs, [&](const DungeonData &dd)
   {
-    init_tiles(map, dd);
-    query_characters_positions(ecs, [&](const Position &pos, const Team &t)
-    {
-      if (t.team == 0) // player team hardcode
-        map[pos.y * dd.width + pos.x] = 0.f;
-    });
-    process_dmap(map, dd);
+    if (sources.dungeon.version != dd.version)
+      sources.dungeon = dd;
+    sources.hasDungeon = true;
+  });
+  sources.players.clear();
+  query_characters_positions(ecs, [&](const Position &pos, const Team &t)
+  {
+    if (t.team == 0) // player team hardcode
+      sources.players.push_back(pos);
   });
+  sources.hives.clear();
+  hiveQuery.each([&](const Position &pos, const Hive &)
+  {
+    sources.hives.push_back(pos);
+  });
+}
+
+static void gen_sources_map(const DungeonData &dd, const std::vector<Position> &positions,
+                            dmaps::SolverState &solver, std::vector<float> &map)
+{
+  init_tiles(map, dd);
+  for (const Position &pos : positions)
+    map[pos.y * dd.width + pos.x] = 0.f;
+  process_dmap(map, dd, solver);
 }
 
-void dmaps::gen_player_flee_map(flecs::world &ecs, std::vector<float> &map)
+void dmaps::gen_player_approach_map(const DmapSources &sources, SolverState &solver, std::vector<float> &map)
 {
-  gen_player_approach_map(ecs, map);
+  gen_sources_map(sources.dungeon, sources.players, solver, map);
+}
+
+void dmaps::gen_player_flee_map(const DmapSources &sources, const std::vector<float> &approach_map,
+                                SolverState &solver, std::vector<float> &map)
+{
+  map = approach_map;
   for (float &v : map)
     if (v < invalid_tile_value)
       v *= -1.2f;
-  query_dungeon_data(ecs, [&](const DungeonData &dd)
-  {
-    process_dmap(map, dd);
-  });
+  process_dmap(map, sources.dungeon, solver);
 }
 
-void dmaps::gen_hive_pack_map(flecs::world &ecs, std::vector<float> &map)
+void dmaps::gen_hive_pack_map(const DmapSources &sources, SolverState &solver, std::vector<float> &map)
 {
-  static auto hiveQuery = ecs.query<const Position, const Hive>();
-  query_dungeon_data(ecs, [&](const DungeonData &dd)
-  {
-    init_tiles(map, dd);
-    hiveQuery.each([&](const Position &pos, const Hive &)
-    {
-      map[pos.y * dd.width + pos.x] = 0.f;
-    });
-    process_dmap(map, dd);
-  });
+  gen_sources_map(sources.dungeon, sources.hives, solver, map);
 }
-
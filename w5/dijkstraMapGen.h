@@ -1,11 +1,33 @@
 #pragma once
 #include <vector>
 #include <flecs.h>
+#include "ecsTypes.h"
 
 namespace dmaps
 {
-  void gen_player_approach_map(flecs::world &ecs, std::vector<float> &map);
-  void gen_player_flee_map(flecs::world &ecs, std::vector<float> &map);
-  void gen_hive_pack_map(flecs::world &ecs, std::vector<float> &map);
+  // Everything maps are generated from, copied out of the world on the main thread,
+  // so generators don't touch ecs and can run on another thread
+  struct DmapSources
+  {
+    DungeonData dungeon;
+    bool hasDungeon = false;
+    std::vector<Position> players;
+    std::vector<Position> hives;
+  };
+
+  void gather_sources(flecs::world &ecs, DmapSources &sources);
+
+  // Dungeon a map was last solved on and whether sweeps gave up on it. Kept per map,
+  // sweeps may round fractional values differently from buckets
+  struct SolverState
+  {
+    uint32_t dungeonVersion = 0;
+    bool twistedDungeon = false;
+  };
+
+  void gen_player_approach_map(const DmapSources &sources, SolverState &solver, std::vector<float> &map);
+  void gen_player_flee_map(const DmapSources &sources, const std::vector<float> &approach_map, SolverState &solver,
+                           std::vector<float> &map);
+  void gen_hive_pack_map(const DmapSources &sources, SolverState &solver, std::vector<float> &map);
 };
 
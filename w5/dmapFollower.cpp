@@ -1,37 +1,161 @@
 #include "ecsTypes.h"
 #include "dmapFollower.h"
 #include <cmath>
+#include <cstdint>
+#include <algorithm>
+
+static float weigh(float v, float mult, float pow)
+{
+  if (v >= 1e5f)
+    return v;
+  return pow == 1.f ? v * mult : powf(v * mult, pow);
+}
+
+// Weighted sum of maps shared by all followers with the same weights (like a pack of hive monsters).
+// Cells are summed on first lookup only, so packs pay once per cell they stand around and
+// nobody pays for the rest of the map. Sums are dropped when any of the maps gets a new version
+struct CompositeMap
+{
+  // terms sorted by map name, so the same weights always sum in the same order
+  std::vector<std::string> mapNames;
+  std::vector<float> mults;
+  std::vector<float> pows;
+
+  std::vector<const DijkstraMapData*> maps;
+  std::vector<uint32_t> versions;
+  std::vector<float> values;
+  std::vector<uint32_t> generation;
+  uint32_t curGeneration = 0;
+  bool used = false;
+
+  bool same_terms(const std::vector<const std::pair<const std::string, DmapWeights::WtData>*> &terms) const
+  {
+    if (terms.size() != mapNames.size())
+      return false;
+    for (size_t i = 0; i < terms.size(); ++i)
+      if (terms[i]->first != mapNames[i] || terms[i]->second.mult != mults[i] || terms[i]->second.pow != pows[i])
+        return false;
+    return true;
+  }
+
+  void sync(flecs::world &ecs, size_t num_cells)
+  {
+    bool changed = values.size() != num_cells;
+    maps.resize(mapNames.size());
+    versions.resize(mapNames.size(), 0);
+    for (size_t i = 0; i < mapNames.size(); ++i)
+    {
+      const DijkstraMapData *dmap = ecs.entity(mapNames[i].c_str()).get<DijkstraMapData>();
+      if (dmap && dmap->map.size() != num_cells) // not generated for this dungeon yet
+        dmap = nullptr;
+      const uint32_t version = dmap ? dmap->version : 0;
+      changed |= dmap != maps[i] || version != versions[i];
+      maps[i] = dmap;
+      versions[i] = version;
+    }
+    if (!changed)
+      return;
+    values.resize(num_cells);
+    if (generation.size() != num_cells)
+      generation.assign(num_cells, curGeneration);
+    if (++curGeneration == 0)
+    {
+      std::fill(generation.begin(), generation.end(), 0);
+      curGeneration = 1;
+    }
+  }
+
+  float at(size_t cell)
+  {
+    if (generation[cell] == curGeneration)
+      return values[cell];
+    float sum = 0.f;
+    for (size_t i = 0; i < maps.size(); ++i)
+      if (maps[i])
+        sum += weigh(maps[i]->map[cell], mults[i], pows[i]);
+    generation[cell] = curGeneration;
+    values[cell] = sum;
+    return sum;
+  }
+};
+
+// Followers flattened into arrays, evaluation pass doesn't touch ecs at all. Buffers are kept between calls
+struct FollowerBatch
+{
+  std::vector<CompositeMap> composites;
+  std::vector<size_t> cells;
+  std::vector<Action*> actions;
+  std::vector<size_t> followerComposites;
+  std::vector<const std::pair<const std::string, DmapWeights::WtData>*> terms; // scratch
+
+  size_t composite_index(const DmapWeights &wt)
+  {
+    terms.clear();
+    for (const auto &pair : wt.weights)
+      terms.push_back(&pair);
+    std::sort(terms.begin(), terms.end(), [](const auto *a, const auto *b) { return a->first < b->first; });
+    for (size_t i = 0; i < composites.size(); ++i)
+      if (composites[i].same_terms(terms))
+        return i;
+    CompositeMap &composite = composites.emplace_back();
+    for (const auto *term : terms)
+    {
+      composite.mapNames.push_back(term->first);
+      composite.mults.push_back(term->second.mult);
+      composite.pows.push_back(term->second.pow);
+    }
+    return composites.size() - 1;
+  }
+};
 
 void process_dmap_followers(flecs::world &ecs)
 {
   static auto processDmapFollowers = ecs.query<const Position, Action, const DmapWeights>();
   static auto dungeonDataQuery = ecs.query<const DungeonData>();
+  static FollowerBatch batch;
 
-  auto get_dmap_at = [&](const DijkstraMapData &dmap, const DungeonData &dd, size_t x, size_t y, float mult, float pow)
-  {
-    const float v = dmap.map[y * dd.width + x];
-    if (v < 1e5f)
-      return powf(v * mult, pow);
-    return v;
-  };
   dungeonDataQuery.each([&](const DungeonData &dd)
   {
+    batch.cells.clear();
+    batch.actions.clear();
+    batch.followerComposites.clear();
     processDmapFollowers.each([&](const Position &pos, Action &act, const DmapWeights &wt)
     {
-      float moveWeights[EA_MOVE_END];
-      for (size_t i = 0; i < EA_MOVE_END; ++i)
-        moveWeights[i] = 0.f;
-      for (const auto &pair : wt.weights)
+      batch.cells.push_back(pos.y * dd.width + pos.x);
+      batch.actions.push_back(&act);
+      batch.followerComposites.push_back(batch.composite_index(wt));
+    });
+
+    // weights nobody has anymore are forgotten, the rest are checked against current maps
+    for (CompositeMap &composite : batch.composites)
+      composite.used = false;
+    for (size_t idx : batch.followerComposites)
+      batch.composites[idx].used = true;
+    std::vector<size_t> remap(batch.composites.size());
+    size_t numUsed = 0;
+    for (size_t i = 0; i < batch.composites.size(); ++i)
+      if (batch.composites[i].used)
       {
-        ecs.entity(pair.first.c_str()).get([&](const DijkstraMapData &dmap)
-        {
-          moveWeights[EA_NOP]         += get_dmap_at(dmap, dd, pos.x+0, pos.y+0, pair.second.mult, pair.second.pow);
-          moveWeights[EA_MOVE_LEFT]   += get_dmap_at(dmap, dd, pos.x-1, pos.y+0, pair.second.mult, pair.second.pow);
-          moveWeights[EA_MOVE_RIGHT]  += get_dmap_at(dmap, dd, pos.x+1, pos.y+0, pair.second.mult, pair.second.pow);
-          moveWeights[EA_MOVE_UP]     += get_dmap_at(dmap, dd, pos.x+0, pos.y-1, pair.second.mult, pair.second.pow);
-          moveWeights[EA_MOVE_DOWN]   += get_dmap_at(dmap, dd, pos.x+0, pos.y+1, pair.second.mult, pair.second.pow);
-        });
+        if (i != numUsed)
+          batch.composites[numUsed] = std::move(batch.composites[i]);
+        remap[i] = numUsed++;
       }
+    batch.composites.resize(numUsed);
+    for (size_t &idx : batch.followerComposites)
+      idx = remap[idx];
+    for (CompositeMap &composite : batch.composites)
+      composite.sync(ecs, dd.width * dd.height);
+
+    // same order as Actions
+    const ptrdiff_t width = ptrdiff_t(dd.width);
+    const ptrdiff_t moveOffsets[EA_MOVE_END] = {0, -1, 1, width, -width};
+    for (size_t f = 0; f < batch.cells.size(); ++f)
+    {
+      CompositeMap &composite = batch.composites[batch.followerComposites[f]];
+      float moveWeights[EA_MOVE_END];
+      for (size_t i = 0; i < EA_MOVE_END; ++i)
+        moveWeights[i] = composite.at(size_t(ptrdiff_t(batch.cells[f]) + moveOffsets[i]));
+      Action &act = *batch.actions[f];
       float minWt = moveWeights[EA_NOP];
       for (size_t i = 0; i < EA_MOVE_END; ++i)
         if (moveWeights[i] < minWt)
@@ -39,7 +163,6 @@ void process_dmap_followers(flecs::world &ecs)
           minWt = moveWeights[i];
           act.action = i;
         }
-    });
+    }
   });
 }
-
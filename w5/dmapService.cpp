@@ -0,0 +1,107 @@
+#include "dmapService.h"
+#include <utility>
+
+static const char *map_names[] = {"approach_map", "flee_map", "hive_map"};
+
+DmapService::DmapService() : service([this]() { service_loop(); })
+{
+}
+
+DmapService::~DmapService()
+{
+  {
+    std::lock_guard<std::mutex> lock(serviceMutex);
+    stop = true;
+  }
+  submitCv.notify_all();
+  service.join();
+}
+
+void DmapService::submit(flecs::world &ecs)
+{
+  // service thread reads sources and back buffers, so they are free only after it's done
+  wait();
+  dmaps::gather_sources(ecs, sources);
+  for (size_t i = 0; i < MAP_NUM; ++i)
+    if (!entities[i])
+      entities[i] = ecs.entity(map_names[i]);
+  {
+    std::lock_guard<std::mutex> lock(serviceMutex);
+    submitted = true;
+  }
+  inFlight = true;
+  submitCv.notify_one();
+}
+
+bool DmapService::poll()
+{
+  if (!inFlight || !ready.load(std::memory_order_acquire))
+    return false;
+  publish();
+  return true;
+}
+
+void DmapService::wait()
+{
+  if (!inFlight)
+    return;
+  {
+    std::unique_lock<std::mutex> lock(serviceMutex);
+    readyCv.wait(lock, [this]() { return ready.load(std::memory_order_acquire); });
+  }
+  publish();
+}
+
+void DmapService::service_loop()
+{
+  while (true)
+  {
+    {
+      std::unique_lock<std::mutex> lock(serviceMutex);
+      submitCv.wait(lock, [this]() { return stop || submitted; });
+      // submitted maps are finished even when stopping, nobody waits for them though
+      if (!submitted)
+        return;
+      submitted = false;
+    }
+    generate();
+    {
+      std::lock_guard<std::mutex> lock(serviceMutex);
+      ready.store(true, std::memory_order_release);
+    }
+    readyCv.notify_all();
+  }
+}
+
+void DmapService::generate()
+{
+  ++version;
+  for (DijkstraMapData &dmap : backMaps)
+  {
+    dmap.map.clear();
+    dmap.version = version;
+  }
+  if (!sources.hasDungeon)
+    return;
+  dmaps::gen_player_approach_map(sources, solvers[MAP_APPROACH], backMaps[MAP_APPROACH].map);
+  dmaps::gen_player_flee_map(sources, backMaps[MAP_APPROACH].map, solvers[MAP_FLEE], backMaps[MAP_FLEE].map);
+  dmaps::gen_hive_pack_map(sources, solvers[MAP_HIVE], backMaps[MAP_HIVE].map);
+}
+
+void DmapService::publish()
+{
+  inFlight = false;
+  ready.store(false, std::memory_order_relaxed);
+  for (size_t i = 0; i < MAP_NUM; ++i)
+  {
+    // swapping leaves previous front in the back buffer, next generation reuses its storage
+    bool swapped = false;
+    entities[i].get([&](DijkstraMapData &front)
+    {
+      std::swap(front, backMaps[i]);
+      swapped = true;
+    });
+    if (!swapped)
+      entities[i].set(backMaps[i]);
+  }
+}
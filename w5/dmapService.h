@@ -0,0 +1,58 @@
+#pragma once
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <flecs.h>
+#include "ecsTypes.h"
+#include "dijkstraMapGen.h"
+
+// Generates turn's dmaps on its own thread into back buffers, while entities named after maps
+// keep the front ones. All maps of a turn are swapped into entities together on the main thread,
+// so followers never see maps of different turns mixed.
+class DmapService
+{
+public:
+  DmapService();
+  ~DmapService();
+
+  DmapService(const DmapService &) = delete;
+  DmapService &operator=(const DmapService &) = delete;
+
+  // Gathers sources and starts generating maps on the service thread.
+  // Maps still being generated from the previous submit are waited for and published first
+  void submit(flecs::world &ecs);
+  // Publishes submitted maps if they are ready, never blocks
+  bool poll();
+  // Blocks until submitted maps are ready and publishes them, returns at once if nothing was submitted
+  void wait();
+
+private:
+  enum MapIdx
+  {
+    MAP_APPROACH,
+    MAP_FLEE,
+    MAP_HIVE,
+    MAP_NUM
+  };
+
+  void service_loop();
+  void generate();
+  void publish();
+
+  dmaps::DmapSources sources;
+  DijkstraMapData backMaps[MAP_NUM]; // hold previous fronts after publishing
+  dmaps::SolverState solvers[MAP_NUM]; // touched only by the service thread
+  flecs::entity entities[MAP_NUM];
+  uint32_t version = 0;
+
+  std::mutex serviceMutex;
+  std::condition_variable submitCv;
+  std::condition_variable readyCv;
+  bool submitted = false;
+  bool stop = false;
+  std::atomic<bool> ready = false;
+  bool inFlight = false; // touched by main thread only
+  std::thread service;
+};
@@ -3,6 +3,7 @@
 #include <string>
 #include <vector>
 #include <unordered_map>
+#include <cstdint>
 
 // TODO: make a lot of seprate files
 struct Position;
@@ -143,11 +144,13 @@ struct DungeonData
   std::vector<char> tiles; // for pathfinding
   size_t width;
   size_t height;
+  uint32_t version = 0; // new for every set of tiles, so users can tell the dungeon changed without comparing them
 };
 
 struct DijkstraMapData
 {
   std::vector<float> map;
+  uint32_t version = 0; // changes every time map is regenerated
 };
 
 struct VisualiseMap {};
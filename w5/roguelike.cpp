@@ -6,7 +6,7 @@
 #include "blackboard.h"
 #include "math.h"
 #include "dungeonUtils.h"
-#include "dijkstraMapGen.h"
+#include "dmapService.h"
 #include "dmapFollower.h"
 #include "dmapBeh.h"
 #include "rlikeObjects.h"
@@ -166,8 +166,9 @@ void init_dungeon(flecs::world &ecs, char *tiles, size_t w, size_t h)
   for (size_t y = 0; y < h; ++y)
     for (size_t x = 0; x < w; ++x)
       dungeonData[y * w + x] = tiles[y * w + x];
+  static uint32_t dungeonVersion = 0;
   ecs.entity("dungeon")
-    .set(DungeonData{dungeonData, w, h});
+    .set(DungeonData{dungeonData, w, h, ++dungeonVersion});
 
   for (size_t y = 0; y < h; ++y)
     for (size_t x = 0; x < w; ++x)
@@ -359,8 +360,11 @@ void process_turn(flecs::world &ecs)
   static auto stateMachineAct = ecs.query<StateMachine>();
   static auto behTreeUpdate = ecs.query<BehaviourTree, Blackboard>();
   static auto turnIncrementer = ecs.query<TurnCounter>();
+  static DmapService dmapService;
   if (is_player_acted(ecs))
   {
+    // turn is decided by maps of the previous one, so they have to be there
+    dmapService.wait();
     if (upd_player_actions_count(ecs))
     {
       // Plan action for NPCs
@@ -381,26 +385,16 @@ void process_turn(flecs::world &ecs)
     }
     process_actions(ecs);
 
-    std::vector<float> approachMap;
-    dmaps::gen_player_approach_map(ecs, approachMap);
-    ecs.entity("approach_map")
-      .set(DijkstraMapData{approachMap});
-
-    std::vector<float> fleeMap;
-    dmaps::gen_player_flee_map(ecs, fleeMap);
-    ecs.entity("flee_map")
-      .set(DijkstraMapData{fleeMap});
-
-    std::vector<float> hiveMap;
-    dmaps::gen_hive_pack_map(ecs, hiveMap);
-    ecs.entity("hive_map")
-      .set(DijkstraMapData{hiveMap});
+    // maps are generated while frames before the next turn are drawn
+    dmapService.submit(ecs);
 
     //ecs.entity("flee_map").add<VisualiseMap>();
     ecs.entity("hive_follower_sum")
       .set(DmapWeights{{{"hive_map", {1.f, 1.f}}, {"approach_map", {1.8f, 0.8f}}}})
       .add<VisualiseMap>();
   }
+  else
+    dmapService.poll();
 }
 
 void print_stats(flecs::world &ecs)
@@ -0,0 +1,41 @@
+#pragma once
+// Seeded map generators shared by hw7_bench and hw7_jps_bench, so every run measures the same maps
+#include "dungeonUtils.h"
+#include <algorithm>
+#include <random>
+#include <vector>
+
+inline DungeonData gen_noise_map(size_t w, size_t h, float wall_chance, unsigned seed)
+{
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<float> chance(0.f, 1.f);
+  DungeonData dd{std::vector<char>(w * h, dungeon::floor), w, h};
+  for (char &tile : dd.tiles)
+    if (chance(rng) < wall_chance)
+      tile = dungeon::wall;
+  return dd;
+}
+
+// Drunkard's walk like gen_drunk_dungeon, but seeded and digging out a fixed share of the map
+inline DungeonData gen_drunk_map(size_t w, size_t h, float floor_share, unsigned seed)
+{
+  std::mt19937 rng(seed);
+  DungeonData dd{std::vector<char>(w * h, dungeon::wall), w, h};
+  const int dirs[4][2] = {{1, 0}, {0, 1}, {-1, 0}, {0, -1}};
+  const size_t toDig = size_t(float(w * h) * floor_share);
+  size_t x = w / 2;
+  size_t y = h / 2;
+  for (size_t dug = 0; dug < toDig;)
+  {
+    char &tile = dd.tiles[y * w + x];
+    if (tile == dungeon::wall)
+    {
+      tile = dungeon::floor;
+      ++dug;
+    }
+    const int *dir = dirs[rng() % 4];
+    x = size_t(std::min(std::max(int(x) + dir[0], 1), int(w) - 2));
+    y = size_t(std::min(std::max(int(y) + dir[1], 1), int(h) - 2));
+  }
+  return dd;
+}
@@ -0,0 +1,111 @@
+// Compares A* and jump point search on generated maps: nodes expanded and mean time per query,
+// both over the whole map and inside of clusters like the ones portals are built for.
+// Usage: hw7_jps_bench [map size] [queries per map]
+#include "pathfinder.h"
+#include "dungeonUtils.h"
+#include "benchMaps.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+struct Query
+{
+  IVec2 from;
+  IVec2 to;
+  IVec2 limMin;
+  IVec2 limMax;
+};
+
+using GridSearchFunc = bool (*)(SearchContext &, const DungeonData &, IVec2, IVec2, IVec2, IVec2, std::vector<IVec2> &);
+
+struct SearchStats
+{
+  size_t found = 0;
+  size_t expanded = 0;
+  size_t pathCells = 0;
+  double ms = 0.0;
+};
+
+static SearchStats run_queries(const DungeonData &dd, const std::vector<Query> &queries, GridSearchFunc search)
+{
+  SearchContext ctx;
+  SearchStats stats;
+  std::vector<IVec2> path;
+  auto start = std::chrono::steady_clock::now();
+  for (const Query &query : queries)
+  {
+    path.clear();
+    if (search(ctx, dd, query.from, query.to, query.limMin, query.limMax, path))
+      ++stats.found;
+    stats.expanded += ctx.expanded;
+    stats.pathCells += path.size();
+  }
+  stats.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  return stats;
+}
+
+static void print_stats(const char *name, const SearchStats &stats, size_t num_queries)
+{
+  printf("%8s %10.1f %12.2f %8zu %12zu\n", name, double(stats.expanded) / double(num_queries),
+         stats.ms * 1000.0 / double(num_queries), stats.found, stats.pathCells);
+}
+
+// cluster_size 0 means queries span the whole map
+static void compare(const char *name, const DungeonData &dd, size_t cluster_size, size_t num_queries)
+{
+  std::vector<IVec2> floors;
+  for (size_t y = 0; y < dd.height; ++y)
+    for (size_t x = 0; x < dd.width; ++x)
+      if (dd.tiles[y * dd.width + x] != dungeon::wall)
+        floors.push_back({int(x), int(y)});
+  if (floors.empty())
+    return;
+  std::mt19937 rng(1);
+  std::vector<Query> queries(num_queries);
+  for (Query &query : queries)
+  {
+    query.from = floors[rng() % floors.size()];
+    if (cluster_size == 0)
+    {
+      query.to = floors[rng() % floors.size()];
+      query.limMin = {0, 0};
+      query.limMax = {int(dd.width), int(dd.height)};
+      continue;
+    }
+    const int split = int(cluster_size);
+    query.limMin = {query.from.x / split * split, query.from.y / split * split};
+    query.limMax = {std::min(query.limMin.x + split, int(dd.width)), std::min(query.limMin.y + split, int(dd.height))};
+    query.to = {query.limMin.x + int(rng() % size_t(query.limMax.x - query.limMin.x)),
+                query.limMin.y + int(rng() % size_t(query.limMax.y - query.limMin.y))};
+  }
+
+  if (cluster_size == 0)
+    printf("%s %zux%zu, whole map\n", name, dd.width, dd.height);
+  else
+    printf("%s %zux%zu, inside of %zux%zu clusters\n", name, dd.width, dd.height, cluster_size, cluster_size);
+  printf("%8s %10s %12s %8s %12s\n", "search", "expanded", "query,us", "found", "path cells");
+  const SearchStats aStar = run_queries(dd, queries, find_path_a_star);
+  const SearchStats jps = run_queries(dd, queries, find_path_jps);
+  print_stats("A*", aStar, queries.size());
+  print_stats("JPS", jps, queries.size());
+  // same total length of found paths means both found shortest ones
+  if (aStar.found != jps.found || aStar.pathCells != jps.pathCells)
+    printf("path lengths differ!\n");
+  printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+  const size_t mapSize = argc > 1 ? size_t(atoi(argv[1])) : 250;
+  const size_t numQueries = argc > 2 ? size_t(atoi(argv[2])) : 200;
+  const DungeonData maps[] = {gen_noise_map(mapSize, mapSize, 0.1f, 1), gen_noise_map(mapSize, mapSize, 0.3f, 2),
+                              gen_drunk_map(mapSize, mapSize, 0.4f, 3)};
+  const char *names[] = {"open (10% walls)", "noisy (30% walls)", "drunk (40% floor)"};
+  for (size_t i = 0; i < 3; ++i)
+  {
+    compare(names[i], maps[i], 0, numQueries);
+    compare(names[i], maps[i], 10, numQueries * 10);
+  }
+  return 0;
+}
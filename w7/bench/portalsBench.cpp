@@ -0,0 +1,166 @@
+// Sweeps cluster sizes of DungeonPortals on generated maps and reports
+// prebuild time, memory taken by the portal graph and mean latency of uncached queries.
+// Then sweeps number of levels of the abstract graph, adding mean time of update_tiles after one tile edit.
+// Usage: hw7_bench [map size] [queries per map]
+#include "pathfinder.h"
+#include "dungeonUtils.h"
+#include "benchMaps.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+template<typename T>
+static size_t vector_bytes(const std::vector<T> &v)
+{
+  return v.capacity() * sizeof(T);
+}
+
+static size_t portals_memory(const DungeonPortals &dp)
+{
+  size_t bytes = vector_bytes(dp.portals) + vector_bytes(dp.tilePortalsIndices) + vector_bytes(dp.levels);
+  for (const PathPortal &portal : dp.portals)
+  {
+    bytes += vector_bytes(portal.conns);
+    for (const PortalConnection &conn : portal.conns)
+      bytes += vector_bytes(conn.path);
+  }
+  for (const std::vector<size_t> &indices : dp.tilePortalsIndices)
+    bytes += vector_bytes(indices);
+  for (const PortalLevel &level : dp.levels)
+  {
+    bytes += vector_bytes(level.edgeOffsets) + vector_bytes(level.edges);
+    bytes += vector_bytes(level.subOffsets) + vector_bytes(level.subEdges);
+    bytes += vector_bytes(level.clusterNodes);
+    for (const std::vector<size_t> &nodes : level.clusterNodes)
+      bytes += vector_bytes(nodes);
+  }
+  return bytes;
+}
+
+static double elapsed_ms(std::chrono::steady_clock::time_point from)
+{
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - from).count();
+}
+
+static std::vector<std::pair<IVec2, IVec2>> gen_queries(const DungeonData &dd, size_t num_queries)
+{
+  std::vector<IVec2> floors;
+  for (size_t y = 0; y < dd.height; ++y)
+    for (size_t x = 0; x < dd.width; ++x)
+      if (dd.tiles[y * dd.width + x] != dungeon::wall)
+        floors.push_back({int(x), int(y)});
+  if (floors.empty())
+    return {};
+  std::mt19937 rng(1);
+  std::vector<std::pair<IVec2, IVec2>> queries(num_queries);
+  for (std::pair<IVec2, IVec2> &query : queries)
+    query = {floors[rng() % floors.size()], floors[rng() % floors.size()]};
+  return queries;
+}
+
+// Mean time of uncached queries in microseconds
+static double time_queries(const DungeonData &dd, const DungeonPortals &dp,
+                           const std::vector<std::pair<IVec2, IVec2>> &queries, size_t &found)
+{
+  found = 0;
+  auto queriesStart = std::chrono::steady_clock::now();
+  for (const std::pair<IVec2, IVec2> &query : queries)
+  {
+    // every query should be a search, not a cache hit
+    dp.cache.paths.clear();
+    dp.cache.routes.clear();
+    if (!find_path_hierarchical(dd, dp, query.first, query.second).empty())
+      ++found;
+  }
+  return elapsed_ms(queriesStart) * 1000.0 / double(queries.size());
+}
+
+static void sweep_cluster_sizes(const char *name, const DungeonData &dd, size_t num_queries, ThreadPool &pool)
+{
+  const std::vector<std::pair<IVec2, IVec2>> queries = gen_queries(dd, num_queries);
+  if (queries.empty())
+    return;
+
+  printf("%s %zux%zu\n", name, dd.width, dd.height);
+  printf("%8s %10s %12s %10s %12s %8s\n", "split", "portals", "prebuild,ms", "memory,KB", "query,us", "found");
+  const size_t splits[] = {5, 6, 8, 10, 12, 16, 20, 24, 32};
+  size_t bestSplit = 0;
+  double bestQuery = 0.0;
+  for (size_t split : splits)
+  {
+    flecs::world ecs;
+    flecs::entity map = ecs.entity().set(dd);
+    auto prebuildStart = std::chrono::steady_clock::now();
+    prebuild_map(ecs, &pool, split);
+    const double prebuildMs = elapsed_ms(prebuildStart);
+    const DungeonPortals &dp = *map.get<DungeonPortals>();
+
+    size_t found = 0;
+    const double queryUs = time_queries(dd, dp, queries, found);
+    printf("%8zu %10zu %12.2f %10zu %12.2f %8zu\n", split, dp.portals.size(), prebuildMs,
+           portals_memory(dp) / 1024, queryUs, found);
+    if (bestSplit == 0 || queryUs < bestQuery)
+    {
+      bestSplit = split;
+      bestQuery = queryUs;
+    }
+  }
+  printf("fastest queries with split %zu\n\n", bestSplit);
+}
+
+static void sweep_levels(const char *name, DungeonData dd, size_t num_queries, ThreadPool &pool)
+{
+  const std::vector<std::pair<IVec2, IVec2>> queries = gen_queries(dd, num_queries);
+  if (queries.empty())
+    return;
+  constexpr size_t split = 10;
+  constexpr size_t numEdits = 20;
+  printf("%s %zux%zu, split %zu\n", name, dd.width, dd.height, split);
+  printf("%8s %12s %10s %12s %10s %8s\n", "levels", "prebuild,ms", "update,ms", "memory,KB", "query,us", "found");
+  for (size_t numLevels = 1; numLevels <= 3; ++numLevels)
+  {
+    flecs::world ecs;
+    flecs::entity map = ecs.entity().set(dd);
+    auto prebuildStart = std::chrono::steady_clock::now();
+    prebuild_map(ecs, &pool, split, GridSearch::AStar, numLevels);
+    const double prebuildMs = elapsed_ms(prebuildStart);
+    DungeonPortals dp = *map.get<DungeonPortals>();
+
+    // every edit is undone by the next one, so all level counts see the same maps
+    std::mt19937 rng(2);
+    double updateMs = 0.0;
+    for (size_t i = 0; i < numEdits; ++i)
+    {
+      const IVec2 tile{int(rng() % dd.width), int(rng() % dd.height)};
+      for (int pass = 0; pass < 2; ++pass)
+      {
+        char &cell = dd.tiles[size_t(tile.y) * dd.width + size_t(tile.x)];
+        cell = cell == dungeon::wall ? dungeon::floor : dungeon::wall;
+        auto updateStart = std::chrono::steady_clock::now();
+        dp.update_tiles(dd, {tile}, &pool);
+        updateMs += elapsed_ms(updateStart);
+      }
+    }
+
+    size_t found = 0;
+    const double queryUs = time_queries(dd, dp, queries, found);
+    printf("%8zu %12.2f %10.2f %12zu %10.2f %8zu\n", numLevels, prebuildMs, updateMs / double(numEdits * 2),
+           portals_memory(dp) / 1024, queryUs, found);
+  }
+  printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+  const size_t mapSize = argc > 1 ? size_t(atoi(argv[1])) : 250;
+  const size_t numQueries = argc > 2 ? size_t(atoi(argv[2])) : 200;
+  ThreadPool pool;
+  sweep_cluster_sizes("open (10% walls)", gen_noise_map(mapSize, mapSize, 0.1f, 1), numQueries, pool);
+  sweep_cluster_sizes("noisy (30% walls)", gen_noise_map(mapSize, mapSize, 0.3f, 2), numQueries, pool);
+  sweep_cluster_sizes("drunk (40% floor)", gen_drunk_map(mapSize, mapSize, 0.4f, 3), numQueries, pool);
+  sweep_levels("noisy (20% walls)", gen_noise_map(mapSize, mapSize, 0.2f, 4), numQueries, pool);
+  sweep_levels("noisy (20% walls)", gen_noise_map(mapSize * 2, mapSize * 2, 0.2f, 5), numQueries, pool);
+  sweep_levels("drunk (40% floor)", gen_drunk_map(mapSize * 2, mapSize * 2, 0.4f, 6), numQueries, pool);
+  return 0;
+}
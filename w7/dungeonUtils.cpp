@@ -30,7 +30,7 @@ bool dungeon::is_tile_walkable(flecs::world &ecs, Position pos)
     if (pos.x < 0 || pos.x >= int(dd.width) ||
         pos.y < 0 || pos.y >= int(dd.height))
       return;
-    res = dd.tiles[size_t(pos.y) * dd.width + size_t(pos.x)] == dungeon::floor;
+    res = dungeon::is_passable(dd.tiles[size_t(pos.y) * dd.width + size_t(pos.x)]);
   });
   return res;
 }
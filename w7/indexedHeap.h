@@ -0,0 +1,137 @@
+#pragma once
+#include <vector>
+#include <limits>
+#include <utility>
+
+// Binary min-heap over node indices [0, numNodes).
+// Keeps track of where every node sits inside the heap, so updating the key
+// of an already queued node (decrease-key) doesn't require a linear search.
+template<typename Key>
+class IndexedHeap
+{
+public:
+  static constexpr size_t npos = std::numeric_limits<size_t>::max();
+
+  void reserve_nodes(size_t num_nodes)
+  {
+    if (heapPos.size() < num_nodes)
+      heapPos.resize(num_nodes, npos);
+  }
+
+  bool empty() const { return heap.empty(); }
+  size_t size() const { return heap.size(); }
+
+  bool contains(size_t node) const
+  {
+    return node < heapPos.size() && heapPos[node] != npos;
+  }
+
+  size_t top() const { return heap.front().node; }
+  const Key &top_key() const { return heap.front().key; }
+
+  // Inserts node or changes its key if it's already queued
+  void push(size_t node, const Key &key)
+  {
+    reserve_nodes(node + 1);
+    size_t pos = heapPos[node];
+    if (pos == npos)
+    {
+      pos = heap.size();
+      heap.push_back({key, node});
+      heapPos[node] = pos;
+      sift_up(pos);
+      return;
+    }
+    const bool decreased = key < heap[pos].key;
+    heap[pos].key = key;
+    if (decreased)
+      sift_up(pos);
+    else
+      sift_down(pos);
+  }
+
+  size_t pop()
+  {
+    const size_t node = heap.front().node;
+    remove_at(0);
+    return node;
+  }
+
+  void remove(size_t node)
+  {
+    if (contains(node))
+      remove_at(heapPos[node]);
+  }
+
+  // Only touches nodes which are still queued, so it's cheap to call between searches
+  void clear()
+  {
+    for (const Entry &entry : heap)
+      heapPos[entry.node] = npos;
+    heap.clear();
+  }
+
+private:
+  struct Entry
+  {
+    Key key;
+    size_t node;
+  };
+
+  void swap_entries(size_t a, size_t b)
+  {
+    std::swap(heap[a], heap[b]);
+    heapPos[heap[a].node] = a;
+    heapPos[heap[b].node] = b;
+  }
+
+  void sift_up(size_t pos)
+  {
+    while (pos > 0)
+    {
+      const size_t parent = (pos - 1) / 2;
+      if (!(heap[pos].key < heap[parent].key))
+        break;
+      swap_entries(pos, parent);
+      pos = parent;
+    }
+  }
+
+  void sift_down(size_t pos)
+  {
+    while (true)
+    {
+      const size_t left = pos * 2 + 1;
+      const size_t right = left + 1;
+      size_t best = pos;
+      if (left < heap.size() && heap[left].key < heap[best].key)
+        best = left;
+      if (right < heap.size() && heap[right].key < heap[best].key)
+        best = right;
+      if (best == pos)
+        break;
+      swap_entries(pos, best);
+      pos = best;
+    }
+  }
+
+  void remove_at(size_t pos)
+  {
+    heapPos[heap[pos].node] = npos;
+    const size_t last = heap.size() - 1;
+    if (pos != last)
+    {
+      heap[pos] = heap[last];
+      heapPos[heap[pos].node] = pos;
+    }
+    heap.pop_back();
+    if (pos < heap.size())
+    {
+      sift_up(pos);
+      sift_down(pos);
+    }
+  }
+
+  std::vector<Entry> heap;
+  std::vector<size_t> heapPos;
+};
@@ -0,0 +1,104 @@
+#pragma once
+#include <vector>
+#include <unordered_map>
+#include <limits>
+#include <cstdint>
+
+// Fixed capacity cache which evicts least recently used entry.
+// Recency list is linked through indices, so the cache stays valid when copied
+template<typename Value>
+class LruCache
+{
+public:
+  explicit LruCache(size_t in_capacity = 256) : capacity(in_capacity > 0 ? in_capacity : 1) {}
+
+  Value *find(uint64_t key)
+  {
+    const auto itf = indices.find(key);
+    if (itf == indices.end())
+      return nullptr;
+    unlink(itf->second);
+    link_front(itf->second);
+    return &entries[itf->second].value;
+  }
+
+  Value &insert(uint64_t key, Value value)
+  {
+    size_t idx = npos;
+    const auto itf = indices.find(key);
+    if (itf != indices.end())
+    {
+      idx = itf->second;
+      unlink(idx);
+    }
+    else if (entries.size() < capacity)
+    {
+      idx = entries.size();
+      entries.push_back({key, Value(), npos, npos});
+    }
+    else
+    {
+      idx = tail;
+      unlink(idx);
+      indices.erase(entries[idx].key);
+    }
+    entries[idx].key = key;
+    entries[idx].value = std::move(value);
+    indices[key] = idx;
+    link_front(idx);
+    return entries[idx].value;
+  }
+
+  size_t size() const { return entries.size(); }
+
+  void clear()
+  {
+    entries.clear();
+    indices.clear();
+    head = npos;
+    tail = npos;
+  }
+
+private:
+  static constexpr size_t npos = std::numeric_limits<size_t>::max();
+
+  struct Entry
+  {
+    uint64_t key;
+    Value value;
+    size_t prev;
+    size_t next;
+  };
+
+  void unlink(size_t idx)
+  {
+    Entry &entry = entries[idx];
+    if (entry.prev != npos)
+      entries[entry.prev].next = entry.next;
+    else
+      head = entry.next;
+    if (entry.next != npos)
+      entries[entry.next].prev = entry.prev;
+    else
+      tail = entry.prev;
+    entry.prev = npos;
+    entry.next = npos;
+  }
+
+  void link_front(size_t idx)
+  {
+    entries[idx].prev = npos;
+    entries[idx].next = head;
+    if (head != npos)
+      entries[head].prev = idx;
+    head = idx;
+    if (tail == npos)
+      tail = idx;
+  }
+
+  size_t capacity;
+  std::vector<Entry> entries;
+  std::unordered_map<uint64_t, size_t> indices;
+  size_t head = npos;
+  size_t tail = npos;
+};
@@ -1,6 +1,7 @@
 #include "pathfinder.h"
 #include "dungeonUtils.h"
 #include "math.h"
+#include "indexedHeap.h"
 #include <algorithm>
 
 float heuristic(IVec2 lhs, IVec2 rhs)
@@ -14,434 +15,1242 @@ static size_t coord_to_idx(T x, T y, size_t w)
   return size_t(y) * w + size_t(x);
 }
 
-static std::vector<IVec2> reconstruct_path(std::vector<IVec2> prev, IVec2 to, size_t width)
+// Appends path ending at `to` to res, walking prev links backwards and reversing once
+static void reconstruct_path(const SearchContext &ctx, IVec2 to, size_t width, std::vector<IVec2> &res)
 {
+  const size_t start = res.size();
   IVec2 curPos = to;
-  std::vector<IVec2> res = {curPos};
-  while (prev[coord_to_idx(curPos.x, curPos.y, width)] != IVec2{-1, -1})
+  res.push_back(curPos);
+  while (ctx.prev[coord_to_idx(curPos.x, curPos.y, width)] != IVec2{-1, -1})
   {
-    curPos = prev[coord_to_idx(curPos.x, curPos.y, width)];
-    res.insert(res.begin(), curPos);
+    curPos = ctx.prev[coord_to_idx(curPos.x, curPos.y, width)];
+    res.push_back(curPos);
   }
-  return res;
+  std::reverse(res.begin() + start, res.end());
 }
 
-static std::vector<IVec2> find_path_a_star(const DungeonData &dd, IVec2 from, IVec2 to,
-                                           IVec2 lim_min, IVec2 lim_max)
+// Each thread keeps its own buffers, so repeated searches don't allocate them again
+static SearchContext &get_search_context()
 {
-  if (from.x < 0 || from.y < 0 || from.x >= int(dd.width) || from.y >= int(dd.height))
-    return std::vector<IVec2>();
-  size_t inpSize = dd.width * dd.height;
-
-  std::vector<float> g(inpSize, std::numeric_limits<float>::max());
-  std::vector<float> f(inpSize, std::numeric_limits<float>::max());
-  std::vector<IVec2> prev(inpSize, {-1,-1});
-
-  auto getG = [&](IVec2 p) -> float { return g[coord_to_idx(p.x, p.y, dd.width)]; };
-  auto getF = [&](IVec2 p) -> float { return f[coord_to_idx(p.x, p.y, dd.width)]; };
+  static thread_local SearchContext ctx;
+  return ctx;
+}
 
-  g[coord_to_idx(from.x, from.y, dd.width)] = 0;
-  f[coord_to_idx(from.x, from.y, dd.width)] = heuristic(from, to);
+// Appends found path to the end of `path`, so callers can reuse (or stitch into) their own buffer
+bool find_path_a_star(SearchContext &ctx, const DungeonData &dd, IVec2 from, IVec2 to,
+                      IVec2 lim_min, IVec2 lim_max, std::vector<IVec2> &path)
+{
+  if (from.x < 0 || from.y < 0 || from.x >= int(dd.width) || from.y >= int(dd.height))
+    return false;
+  ctx.begin_search(dd.width * dd.height);
 
-  std::vector<IVec2> openList = {from};
-  std::vector<IVec2> closedList;
+  size_t fromIdx = coord_to_idx(from.x, from.y, dd.width);
+  ctx.touch(fromIdx);
+  ctx.g[fromIdx] = 0;
+  ctx.openList.push(fromIdx, heuristic(from, to));
 
-  while (!openList.empty())
+  while (!ctx.openList.empty())
   {
-    size_t bestIdx = 0;
-    float bestScore = getF(openList[0]);
-    for (size_t i = 1; i < openList.size(); ++i)
+    size_t idx = ctx.openList.pop();
+    ++ctx.expanded;
+    IVec2 curPos{int(idx % dd.width), int(idx / dd.width)};
+    if (curPos == to)
     {
-      float score = getF(openList[i]);
-      if (score < bestScore)
-      {
-        bestIdx = i;
-        bestScore = score;
-      }
+      reconstruct_path(ctx, to, dd.width, path);
+      return true;
     }
-    if (openList[bestIdx] == to)
-      return reconstruct_path(prev, to, dd.width);
-    IVec2 curPos = openList[bestIdx];
-    openList.erase(openList.begin() + bestIdx);
-    if (std::find(closedList.begin(), closedList.end(), curPos) != closedList.end())
-      continue;
-    size_t idx = coord_to_idx(curPos.x, curPos.y, dd.width);
-    closedList.emplace_back(curPos);
+    ctx.closed[idx] = 1;
     auto checkNeighbour = [&](IVec2 p)
     {
       // out of bounds
       if (p.x < lim_min.x || p.y < lim_min.y || p.x >= lim_max.x || p.y >= lim_max.y)
         return;
-      size_t idx = coord_to_idx(p.x, p.y, dd.width);
+      size_t nidx = coord_to_idx(p.x, p.y, dd.width);
       // not empty
-      if (dd.tiles[idx] == dungeon::wall)
+      if (!dungeon::is_passable(dd.tiles[nidx]))
         return;
-      float edgeWeight = 1.f;
-      float gScore = getG(curPos) + 1.f * edgeWeight; // we're exactly 1 unit away
-      if (gScore < getG(p))
+      ctx.touch(nidx);
+      // heuristic is consistent, so closed nodes can't be improved
+      if (ctx.closed[nidx])
+        return;
+      float edgeWeight = float(dungeon::tile_cost(dd.tiles[nidx]));
+      float gScore = ctx.g[idx] + 1.f * edgeWeight; // we're exactly 1 unit away
+      if (gScore < ctx.g[nidx])
       {
-        prev[idx] = curPos;
-        g[idx] = gScore;
-        f[idx] = gScore + heuristic(p, to);
+        ctx.prev[nidx] = curPos;
+        ctx.g[nidx] = gScore;
+        ctx.openList.push(nidx, gScore + heuristic(p, to));
       }
-      bool found = std::find(openList.begin(), openList.end(), p) != openList.end();
-      if (!found)
-        openList.emplace_back(p);
     };
     checkNeighbour({curPos.x + 1, curPos.y + 0});
     checkNeighbour({curPos.x - 1, curPos.y + 0});
     checkNeighbour({curPos.x + 0, curPos.y + 1});
     checkNeighbour({curPos.x + 0, curPos.y - 1});
   }
-  // empty path
-  return std::vector<IVec2>();
+  return false;
 }
 
-constexpr size_t splitTiles = 10;
+// Walkable cells of [lim_min, lim_max) jump point search moves over. Cells costing more than plain floor
+// to enter are never jumped over: runs stop on such cells and expand them like A* does
+struct JumpGrid
+{
+  const DungeonData &dd;
+  IVec2 limMin;
+  IVec2 limMax;
+  IVec2 to;
+
+  bool walkable(IVec2 p) const
+  {
+    return p.x >= limMin.x && p.y >= limMin.y && p.x < limMax.x && p.y < limMax.y &&
+           dungeon::is_passable(dd.tiles[coord_to_idx(p.x, p.y, dd.width)]);
+  }
 
-void prebuild_map(flecs::world &ecs)
+  bool plain(IVec2 p) const
+  {
+    return walkable(p) && dungeon::tile_cost(dd.tiles[coord_to_idx(p.x, p.y, dd.width)]) == 1;
+  }
+
+  // Shortest paths are taken to go vertically first, so horizontal run only has to stop where a cell
+  // above or below opens up while going there from the previous cell would've been costlier or impossible
+  bool jump_horizontal(IVec2 from, int dx, IVec2 &jump_point) const
+  {
+    for (IVec2 cur = from;; cur.x += dx)
+    {
+      const IVec2 next{cur.x + dx, cur.y};
+      if (!walkable(next))
+        return false;
+      if (next == to || !plain(next) ||
+          (walkable({next.x, next.y - 1}) && !plain({cur.x, cur.y - 1})) ||
+          (walkable({next.x, next.y + 1}) && !plain({cur.x, cur.y + 1})))
+      {
+        jump_point = next;
+        return true;
+      }
+    }
+  }
+
+  // Vertical run can turn anywhere, so it stops at cells from which horizontal runs find something
+  bool jump_vertical(IVec2 from, int dy, IVec2 &jump_point) const
+  {
+    for (IVec2 cur = {from.x, from.y + dy}; walkable(cur); cur.y += dy)
+    {
+      IVec2 sideJump;
+      if (cur == to || !plain(cur) || jump_horizontal(cur, 1, sideJump) || jump_horizontal(cur, -1, sideJump))
+      {
+        jump_point = cur;
+        return true;
+      }
+    }
+    return false;
+  }
+};
+
+static int sign(int v)
 {
-  auto mapQuery = ecs.query<const DungeonData>();
+  return (v > 0) - (v < 0);
+}
 
-  ecs.defer([&]()
+// Same as reconstruct_path, but prev links lead to previous jump points, cells between them are filled in
+static void reconstruct_jump_path(const SearchContext &ctx, IVec2 to, size_t width, std::vector<IVec2> &res)
+{
+  const size_t start = res.size();
+  for (IVec2 curPos = to; curPos != IVec2{-1, -1};)
   {
-    mapQuery.each([&](flecs::entity e, const DungeonData &dd)
+    const IVec2 prevPos = ctx.prev[coord_to_idx(curPos.x, curPos.y, width)];
+    if (prevPos == IVec2{-1, -1})
     {
-      // go through each super tile
-      const size_t width = dd.width / splitTiles;
-      const size_t height = dd.height / splitTiles;
-
-      auto check_border = [&](size_t xx, size_t yy,
-                              size_t dir_x, size_t dir_y,
-                              int offs_x, int offs_y,
-                              std::vector<PathPortal> &portals)
+      res.push_back(curPos);
+      break;
+    }
+    const IVec2 step{sign(prevPos.x - curPos.x), sign(prevPos.y - curPos.y)};
+    for (IVec2 p = curPos; p != prevPos; p = {p.x + step.x, p.y + step.y})
+      res.push_back(p);
+    curPos = prevPos;
+  }
+  std::reverse(res.begin() + start, res.end());
+}
+
+bool find_path_jps(SearchContext &ctx, const DungeonData &dd, IVec2 from, IVec2 to,
+                   IVec2 lim_min, IVec2 lim_max, std::vector<IVec2> &path)
+{
+  if (from.x < 0 || from.y < 0 || from.x >= int(dd.width) || from.y >= int(dd.height))
+    return false;
+  ctx.begin_search(dd.width * dd.height);
+  const JumpGrid grid{dd, lim_min, lim_max, to};
+
+  size_t fromIdx = coord_to_idx(from.x, from.y, dd.width);
+  ctx.touch(fromIdx);
+  ctx.g[fromIdx] = 0;
+  ctx.openList.push(fromIdx, heuristic(from, to));
+
+  while (!ctx.openList.empty())
+  {
+    size_t idx = ctx.openList.pop();
+    ++ctx.expanded;
+    IVec2 curPos{int(idx % dd.width), int(idx / dd.width)};
+    if (curPos == to)
+    {
+      reconstruct_jump_path(ctx, to, dd.width, path);
+      return true;
+    }
+    ctx.closed[idx] = 1;
+    auto checkJump = [&](int dx, int dy)
+    {
+      IVec2 p;
+      if (dx != 0 ? !grid.jump_horizontal(curPos, dx, p) : !grid.jump_vertical(curPos, dy, p))
+        return;
+      size_t nidx = coord_to_idx(p.x, p.y, dd.width);
+      ctx.touch(nidx);
+      if (ctx.closed[nidx])
+        return;
+      // every cell before the jump point is plain floor
+      float steps = float(std::abs(p.x - curPos.x) + std::abs(p.y - curPos.y));
+      float gScore = ctx.g[idx] + steps - 1.f + float(dungeon::tile_cost(dd.tiles[nidx]));
+      if (gScore < ctx.g[nidx])
       {
-        int spanFrom = -1;
-        int spanTo = -1;
-        for (size_t i = 0; i < splitTiles; ++i)
-        {
-          size_t x = xx * splitTiles + i * dir_x;
-          size_t y = yy * splitTiles + i * dir_y;
-          size_t nx = x + offs_x;
-          size_t ny = y + offs_y;
-          if (dd.tiles[y * dd.width + x] != dungeon::wall &&
-              dd.tiles[ny * dd.width + nx] != dungeon::wall)
-          {
-            if (spanFrom < 0)
-              spanFrom = i;
-            spanTo = i;
-          }
-          else if (spanFrom >= 0)
-          {
-            // write span
-            portals.push_back({xx * splitTiles + spanFrom * dir_x + offs_x,
-                               yy * splitTiles + spanFrom * dir_y + offs_y,
-                               xx * splitTiles + spanTo * dir_x,
-                               yy * splitTiles + spanTo * dir_y});
-            spanFrom = -1;
-          }
-        }
-        if (spanFrom >= 0)
-        {
-          portals.push_back({xx * splitTiles + spanFrom * dir_x + offs_x,
-                             yy * splitTiles + spanFrom * dir_y + offs_y,
-                             xx * splitTiles + spanTo * dir_x,
-                             yy * splitTiles + spanTo * dir_y});
-        }
-      };
+        ctx.prev[nidx] = curPos;
+        ctx.g[nidx] = gScore;
+        ctx.openList.push(nidx, gScore + heuristic(p, to));
+      }
+    };
+    const IVec2 prevPos = ctx.prev[idx];
+    if (prevPos == IVec2{-1, -1} || !grid.plain(curPos))
+    {
+      checkJump(1, 0);
+      checkJump(-1, 0);
+      checkJump(0, 1);
+      checkJump(0, -1);
+    }
+    else if (prevPos.x == curPos.x)
+    {
+      checkJump(0, sign(curPos.y - prevPos.y));
+      checkJump(1, 0);
+      checkJump(-1, 0);
+    }
+    else
+    {
+      // horizontal runs only turn where the cell behind had no cheap way up or down
+      const int dx = sign(curPos.x - prevPos.x);
+      checkJump(dx, 0);
+      if (!grid.plain({curPos.x - dx, curPos.y - 1}))
+        checkJump(0, -1);
+      if (!grid.plain({curPos.x - dx, curPos.y + 1}))
+        checkJump(0, 1);
+    }
+  }
+  return false;
+}
 
-      std::vector<PathPortal> portals;
-      std::vector<std::vector<size_t>> tilePortalsIndices;
+static bool find_path_in_cluster(SearchContext &ctx, const DungeonData &dd, const DungeonPortals &dp,
+                                 IVec2 from, IVec2 to, IVec2 lim_min, IVec2 lim_max, std::vector<IVec2> &path)
+{
+  if (dp.gridSearch == GridSearch::JumpPoint)
+    return find_path_jps(ctx, dd, from, to, lim_min, lim_max, path);
+  return find_path_a_star(ctx, dd, from, to, lim_min, lim_max, path);
+}
 
-      auto push_portals = [&](size_t x, size_t y,
-                              int offs_x, int offs_y,
-                              const std::vector<PathPortal> &new_portals)
+// Dijkstra flood seeded from every cell of [seed_min, seed_max] at once, limited to [lim_min, lim_max).
+// Afterwards ctx holds distances from the closest seed and prev links leading back to it.
+// Tiles are paid for when entered, so walking towards seeds costs differently: with `towards` set
+// tiles are paid for when left and ctx holds distances to the closest seed instead
+static void flood_from_span(SearchContext &ctx, const DungeonData &dd, IVec2 seed_min, IVec2 seed_max,
+                            IVec2 lim_min, IVec2 lim_max, bool towards = false)
+{
+  ctx.begin_search(dd.width * dd.height);
+  for (int y = seed_min.y; y <= seed_max.y; ++y)
+    for (int x = seed_min.x; x <= seed_max.x; ++x)
+    {
+      size_t idx = coord_to_idx(x, y, dd.width);
+      ctx.touch(idx);
+      ctx.g[idx] = 0.f;
+      ctx.openList.push(idx, 0.f);
+    }
+
+  while (!ctx.openList.empty())
+  {
+    size_t idx = ctx.openList.pop();
+    IVec2 curPos{int(idx % dd.width), int(idx / dd.width)};
+    ctx.closed[idx] = 1;
+    auto checkNeighbour = [&](IVec2 p)
+    {
+      if (p.x < lim_min.x || p.y < lim_min.y || p.x >= lim_max.x || p.y >= lim_max.y)
+        return;
+      size_t nidx = coord_to_idx(p.x, p.y, dd.width);
+      if (!dungeon::is_passable(dd.tiles[nidx]))
+        return;
+      ctx.touch(nidx);
+      if (ctx.closed[nidx])
+        return;
+      float gScore = ctx.g[idx] + float(dungeon::tile_cost(dd.tiles[towards ? idx : nidx]));
+      if (gScore < ctx.g[nidx])
       {
-        for (const PathPortal &portal : new_portals)
-        {
-          size_t idx = portals.size();
-          portals.push_back(portal);
-          tilePortalsIndices[y * width + x].push_back(idx);
-          tilePortalsIndices[(y + offs_y) * width + x + offs_x].push_back(idx);
-        }
-      };
-      for (size_t y = 0; y < height; ++y)
-        for (size_t x = 0; x < width; ++x)
-        {
-          tilePortalsIndices.push_back(std::vector<size_t>{});
-          // check top
-          if (y > 0)
-          {
-            std::vector<PathPortal> topPortals;
-            check_border(x, y, 1, 0, 0, -1, topPortals);
-            push_portals(x, y, 0, -1, topPortals);
-          }
-          // left
-          if (x > 0)
-          {
-            std::vector<PathPortal> leftPortals;
-            check_border(x, y, 0, 1, -1, 0, leftPortals);
-            push_portals(x, y, -1, 0, leftPortals);
-          }
-        }
-      for (size_t tidx = 0; tidx < tilePortalsIndices.size(); ++tidx)
+        ctx.prev[nidx] = curPos;
+        ctx.g[nidx] = gScore;
+        ctx.openList.push(nidx, gScore);
+      }
+    };
+    checkNeighbour({curPos.x + 1, curPos.y + 0});
+    checkNeighbour({curPos.x - 1, curPos.y + 0});
+    checkNeighbour({curPos.x + 0, curPos.y + 1});
+    checkNeighbour({curPos.x + 0, curPos.y - 1});
+  }
+}
+
+// Finds the cell of [span_min, span_max] closest to the flood sources, false if none was reached
+static bool find_closest_cell(const SearchContext &ctx, const DungeonData &dd, IVec2 span_min, IVec2 span_max,
+                              IVec2 &closest)
+{
+  float best = std::numeric_limits<float>::max();
+  for (int y = span_min.y; y <= span_max.y; ++y)
+    for (int x = span_min.x; x <= span_max.x; ++x)
+    {
+      float dist = ctx.get_g(coord_to_idx(x, y, dd.width));
+      if (dist < best)
       {
-        const std::vector<size_t> &indices = tilePortalsIndices[tidx];
-        size_t x = tidx % width;
-        size_t y = tidx / width;
-        IVec2 limMin{int((x + 0) * splitTiles), int((y + 0) * splitTiles)};
-        IVec2 limMax{int((x + 1) * splitTiles), int((y + 1) * splitTiles)};
-        for (size_t i = 0; i < indices.size(); ++i)
-        {
-          PathPortal &firstPortal = portals[indices[i]];
-          for (size_t j = i + 1; j < indices.size(); ++j)
-          {
-            PathPortal &secondPortal = portals[indices[j]];
-            // check path from i to j
-            // check each position (to find closest dist) (could be made more optimal)
-            bool noPath = false;
-            std::vector<IVec2> optimalPath {};
-            for (size_t fromY = std::max(firstPortal.startY, size_t(limMin.y));
-                        fromY <= std::min(firstPortal.endY, size_t(limMax.y - 1)) && !noPath; ++fromY)
-            {
-              for (size_t fromX = std::max(firstPortal.startX, size_t(limMin.x));
-                          fromX <= std::min(firstPortal.endX, size_t(limMax.x - 1)) && !noPath; ++fromX)
-              {
-                for (size_t toY = std::max(secondPortal.startY, size_t(limMin.y));
-                            toY <= std::min(secondPortal.endY, size_t(limMax.y - 1)) && !noPath; ++toY)
-                {
-                  for (size_t toX = std::max(secondPortal.startX, size_t(limMin.x));
-                              toX <= std::min(secondPortal.endX, size_t(limMax.x - 1)) && !noPath; ++toX)
-                  {
-                    IVec2 from{int(fromX), int(fromY)};
-                    IVec2 to{int(toX), int(toY)};
-                    std::vector<IVec2> path = find_path_a_star(dd, from, to, limMin, limMax);
-                    if (path.empty() && from != to)
-                    {
-                      noPath = true; // if we found that there's no path at all - we can break out
-                      break;
-                    }
-                    if (optimalPath.empty() || path.size() < optimalPath.size()) {
-                      optimalPath = path;
-                    }
-                  }
-                }
-              }
-            }
-            // write pathable data and length
-            if (noPath)
-              continue;
-            firstPortal.conns.push_back({indices[j], float(optimalPath.size()), optimalPath});
-            std::reverse(optimalPath.begin(), optimalPath.end());
-            secondPortal.conns.push_back({indices[i], float(optimalPath.size()), optimalPath});
-          }
-        }
+        best = dist;
+        closest = {x, y};
       }
-      e.set(DungeonPortals{splitTiles, portals, tilePortalsIndices});
+    }
+  return best < std::numeric_limits<float>::max();
+}
+
+// Cells of the portal which lie inside of the cluster [lim_min, lim_max), bounds are inclusive
+static void clip_portal(const PathPortal &portal, IVec2 lim_min, IVec2 lim_max, IVec2 &span_min, IVec2 &span_max)
+{
+  span_min = {std::max(int(portal.startX), lim_min.x), std::max(int(portal.startY), lim_min.y)};
+  span_max = {std::min(int(portal.endX), lim_max.x - 1), std::min(int(portal.endY), lim_max.y - 1)};
+}
+
+// clusters of every next level are levelScale x levelScale clusters of the previous one
+constexpr size_t levelScale = 4;
+
+// Clusters of one level, ones on the right and bottom edges are cut short if split doesn't divide map size
+struct ClusterGrid
+{
+  size_t split;
+  size_t mapWidth;
+  size_t mapHeight;
+  size_t width;
+  size_t height;
+
+  ClusterGrid(const DungeonData &dd, size_t in_split)
+    : split(in_split), mapWidth(dd.width), mapHeight(dd.height),
+      width((dd.width + in_split - 1) / in_split), height((dd.height + in_split - 1) / in_split) {}
+
+  size_t size() const { return width * height; }
+
+  // size() if cell is outside of the map
+  size_t cluster_of(size_t x, size_t y) const
+  {
+    if (x >= mapWidth || y >= mapHeight)
+      return size();
+    return (y / split) * width + x / split;
+  }
+  size_t cluster_of(IVec2 p) const { return cluster_of(size_t(p.x), size_t(p.y)); }
+
+  // Cells of the cluster are [lim_min, lim_max)
+  void bounds(size_t cluster, IVec2 &lim_min, IVec2 &lim_max) const
+  {
+    size_t x = cluster % width;
+    size_t y = cluster / width;
+    lim_min = {int(x * split), int(y * split)};
+    lim_max = {int(std::min((x + 1) * split, mapWidth)), int(std::min((y + 1) * split, mapHeight))};
+  }
+};
+
+// Finds walkable spans on the border between cluster (xx, yy) and its neighbour at (offs_x, offs_y)
+static void check_border(const DungeonData &dd, size_t split, size_t length,
+                         size_t xx, size_t yy,
+                         size_t dir_x, size_t dir_y,
+                         int offs_x, int offs_y,
+                         std::vector<PathPortal> &portals)
+{
+  int spanFrom = -1;
+  int spanTo = -1;
+  for (size_t i = 0; i < length; ++i)
+  {
+    size_t x = xx * split + i * dir_x;
+    size_t y = yy * split + i * dir_y;
+    size_t nx = x + offs_x;
+    size_t ny = y + offs_y;
+    if (dungeon::is_passable(dd.tiles[y * dd.width + x]) &&
+        dungeon::is_passable(dd.tiles[ny * dd.width + nx]))
+    {
+      if (spanFrom < 0)
+        spanFrom = i;
+      spanTo = i;
+    }
+    else if (spanFrom >= 0)
+    {
+      // write span
+      portals.push_back({xx * split + spanFrom * dir_x + offs_x,
+                         yy * split + spanFrom * dir_y + offs_y,
+                         xx * split + spanTo * dir_x,
+                         yy * split + spanTo * dir_y, {}});
+      spanFrom = -1;
+    }
+  }
+  if (spanFrom >= 0)
+  {
+    portals.push_back({xx * split + spanFrom * dir_x + offs_x,
+                       yy * split + spanFrom * dir_y + offs_y,
+                       xx * split + spanTo * dir_x,
+                       yy * split + spanTo * dir_y, {}});
+  }
+}
+
+enum ClusterBorder
+{
+  BORDER_TOP,
+  BORDER_LEFT
+};
+
+// Derives portals on top or left border of a cluster and registers them in both adjacent clusters
+static void build_border_portals(const DungeonData &dd, DungeonPortals &dp, size_t x, size_t y, ClusterBorder border)
+{
+  const ClusterGrid grid(dd, dp.tileSplit);
+  const size_t width = grid.width;
+  const int offsX = border == BORDER_LEFT ? -1 : 0;
+  const int offsY = border == BORDER_TOP ? -1 : 0;
+  IVec2 limMin, limMax;
+  grid.bounds(y * width + x, limMin, limMax);
+  std::vector<PathPortal> newPortals;
+  if (border == BORDER_TOP)
+    check_border(dd, dp.tileSplit, size_t(limMax.x - limMin.x), x, y, 1, 0, offsX, offsY, newPortals);
+  else
+    check_border(dd, dp.tileSplit, size_t(limMax.y - limMin.y), x, y, 0, 1, offsX, offsY, newPortals);
+  for (PathPortal &portal : newPortals)
+  {
+    size_t idx = dp.portals.size();
+    dp.portals.push_back(std::move(portal));
+    dp.tilePortalsIndices[y * width + x].push_back(idx);
+    dp.tilePortalsIndices[(y + offsY) * width + x + offsX].push_back(idx);
+  }
+}
+
+struct ClusterConnection
+{
+  size_t portalIdx;
+  PortalConnection conn;
+};
+
+// Connects every pair of portals of a cluster with the cheapest path inside of it, in both directions.
+// One flood from all cells of a portal gives exact costs of getting to every other portal of the cluster.
+// Only reads portals, so different clusters can be processed concurrently
+static void connect_cluster_portals(const DungeonData &dd, const DungeonPortals &dp, size_t tidx,
+                                    SearchContext &ctx, std::vector<ClusterConnection> &conns)
+{
+  const std::vector<size_t> &indices = dp.tilePortalsIndices[tidx];
+  IVec2 limMin, limMax;
+  ClusterGrid(dd, dp.tileSplit).bounds(tidx, limMin, limMax);
+  std::vector<IVec2> path;
+  // paying for entered tiles isn't symmetric, so reversed path isn't always the cheapest one back
+  // and every portal gets a flood of its own for its outgoing connections
+  for (size_t i = 0; i < indices.size(); ++i)
+  {
+    IVec2 spanMin, spanMax;
+    clip_portal(dp.portals[indices[i]], limMin, limMax, spanMin, spanMax);
+    flood_from_span(ctx, dd, spanMin, spanMax, limMin, limMax);
+    for (size_t j = 0; j < indices.size(); ++j)
+    {
+      IVec2 target;
+      if (j == i)
+        continue;
+      clip_portal(dp.portals[indices[j]], limMin, limMax, spanMin, spanMax);
+      if (!find_closest_cell(ctx, dd, spanMin, spanMax, target))
+        continue;
+      // write pathable data and cost
+      path.clear();
+      reconstruct_path(ctx, target, dd.width, path);
+      conns.push_back({indices[i], {indices[j], ctx.g[coord_to_idx(target.x, target.y, dd.width)], path}});
+    }
+  }
+}
+
+// Builds connections of given clusters, in parallel if pool is provided.
+// Results are merged in cluster order, so the graph doesn't depend on scheduling
+static void connect_clusters(const DungeonData &dd, DungeonPortals &dp, const std::vector<size_t> &clusters,
+                             ThreadPool *pool)
+{
+  std::vector<std::vector<ClusterConnection>> clusterConns(clusters.size());
+  auto connect = [&](size_t i)
+  {
+    connect_cluster_portals(dd, dp, clusters[i], get_search_context(), clusterConns[i]);
+  };
+  if (pool)
+    pool->parallel_for(clusters.size(), connect);
+  else
+    for (size_t i = 0; i < clusters.size(); ++i)
+      connect(i);
+  for (std::vector<ClusterConnection> &conns : clusterConns)
+    for (ClusterConnection &cc : conns)
+      dp.portals[cc.portalIdx].conns.push_back(std::move(cc.conn));
+}
+
+static DungeonPortals build_portals(const DungeonData &dd, ThreadPool *pool, size_t split_tiles,
+                                    GridSearch grid_search, size_t num_levels)
+{
+  DungeonPortals dp;
+  dp.tileSplit = split_tiles;
+  dp.gridSearch = grid_search;
+  dp.levels.resize(std::max(num_levels, size_t(1)));
+  for (size_t level = 0, split = split_tiles; level < dp.levels.size(); ++level, split *= levelScale)
+    dp.levels[level].tileSplit = split;
+  // go through each super tile
+  const ClusterGrid grid(dd, split_tiles);
+  dp.tilePortalsIndices.resize(grid.size());
+  for (size_t y = 0; y < grid.height; ++y)
+    for (size_t x = 0; x < grid.width; ++x)
+    {
+      if (y > 0)
+        build_border_portals(dd, dp, x, y, BORDER_TOP);
+      if (x > 0)
+        build_border_portals(dd, dp, x, y, BORDER_LEFT);
+    }
+  std::vector<size_t> clusters(dp.tilePortalsIndices.size());
+  for (size_t tidx = 0; tidx < clusters.size(); ++tidx)
+    clusters[tidx] = tidx;
+  connect_clusters(dd, dp, clusters, pool);
+  dp.build_levels(dd, pool);
+  return dp;
+}
+
+void prebuild_map(flecs::world &ecs, ThreadPool *pool, size_t split_tiles, GridSearch grid_search,
+                  size_t num_levels)
+{
+  auto mapQuery = ecs.query<const DungeonData>();
+
+  ecs.defer([&]()
+  {
+    mapQuery.each([&](flecs::entity e, const DungeonData &dd)
+    {
+      e.set(build_portals(dd, pool, split_tiles, grid_search, num_levels));
     });
   });
 }
 
-static std::vector<IVec2> reconstruct_path_hierarchical(const DungeonData &dd, const DungeonPortals& dp, std::vector<size_t> prev,
-                                           size_t fromIdx, std::vector<std::vector<IVec2>> fromConn,
-                                           size_t toIdx, std::vector<std::vector<IVec2>> toConn)
+constexpr size_t removedIdx = std::numeric_limits<size_t>::max();
+
+// Where portals and edges of the previous build ended up after update_tiles, removedIdx for removed ones
+struct LevelRemap
+{
+  std::vector<size_t> portals;
+  std::vector<uint8_t> dirtyClusters; // level 0 clusters which got their connections rebuilt
+  std::vector<size_t> lowerEdges; // edges of the level below the one being rebuilt
+};
+
+static void update_levels(const DungeonData &dd, DungeonPortals &dp, LevelRemap &remap,
+                          const std::vector<size_t> &kept_conns, ThreadPool *pool);
+
+void DungeonPortals::update_tiles(const DungeonData &dd, const std::vector<IVec2> &changed_tiles, ThreadPool *pool)
 {
-  size_t curIdx = toIdx;
-  std::vector<IVec2> res{};
-  auto addToPath = [&dd, &dp, &res, &curIdx](std::vector<IVec2> &connections)
+  const ClusterGrid grid(dd, tileSplit);
+  const size_t width = grid.width;
+  const size_t height = grid.height;
+  const size_t numClusters = grid.size();
+
+  // clusters with changed tiles get all of their borders re-derived,
+  // their neighbours share those borders, so their connections have to be redone as well
+  std::vector<uint8_t> changedCluster(numClusters, 0);
+  std::vector<uint8_t> dirtyCluster(numClusters, 0);
+  bool anyChanged = false;
+  for (const IVec2 &tile : changed_tiles)
   {
-    auto innerPath = find_path_a_star(dd, connections.back(), res.front(), 
-                                      {(int)dp.portals[curIdx].startX, (int)dp.portals[curIdx].startY}, 
-                                      {(int)dp.portals[curIdx].endX + 1, (int)dp.portals[curIdx].endY + 1});
-    res.insert(res.begin(), innerPath.begin(), innerPath.end());
-    res.insert(res.begin(), connections.begin(), connections.end());
+    if (tile.x < 0 || tile.y < 0)
+      continue;
+    size_t tidx = grid.cluster_of(size_t(tile.x), size_t(tile.y));
+    if (tidx >= numClusters)
+      continue;
+    anyChanged = true;
+    changedCluster[tidx] = 1;
+    size_t x = tidx % width;
+    size_t y = tidx / width;
+    dirtyCluster[tidx] = 1;
+    if (x > 0)
+      dirtyCluster[tidx - 1] = 1;
+    if (x + 1 < width)
+      dirtyCluster[tidx + 1] = 1;
+    if (y > 0)
+      dirtyCluster[tidx - width] = 1;
+    if (y + 1 < height)
+      dirtyCluster[tidx + width] = 1;
+  }
+  if (!anyChanged)
+    return;
+  ++version;
+
+  // keep portals which don't lie on re-derived borders, dropping connections inside dirty clusters
+  auto is_rederived = [&](const PathPortal &portal)
+  {
+    return changedCluster[grid.cluster_of(portal.startX, portal.startY)] ||
+           changedCluster[grid.cluster_of(portal.endX, portal.endY)];
   };
-  while (prev[curIdx] < dp.portals.size() + 2)
-  {
-    size_t prevIdx = prev[curIdx];
-    if (curIdx == toIdx) 
-      res.insert(res.begin(), toConn[prevIdx].begin(), toConn[prevIdx].end());
-    else if (prevIdx == fromIdx)
-      addToPath(fromConn[curIdx]);
-    else {
-      auto& allConnections = dp.portals[prevIdx].conns;
-      auto path = (*std::find_if(allConnections.begin(), allConnections.end(), [&](auto& conn){ return conn.connIdx == curIdx; })).path;
-      addToPath(path);
+  LevelRemap levelRemap{std::vector<size_t>(portals.size(), removedIdx), std::move(dirtyCluster), {}};
+  std::vector<size_t> &remap = levelRemap.portals;
+  size_t numKept = 0;
+  for (size_t i = 0; i < portals.size(); ++i)
+    if (!is_rederived(portals[i]))
+      remap[i] = numKept++;
+  // position of every level 0 edge among connections its portal kept, they stay in front of new ones
+  const PortalLevel &base = levels.front();
+  std::vector<size_t> keptConns(base.edges.size(), removedIdx);
+  std::vector<PathPortal> keptPortals;
+  keptPortals.reserve(numKept);
+  for (size_t i = 0; i < portals.size(); ++i)
+  {
+    if (remap[i] == removedIdx)
+      continue;
+    PathPortal &portal = portals[i];
+    size_t numConns = 0;
+    for (size_t k = 0; k < portal.conns.size(); ++k)
+    {
+      PortalConnection &conn = portal.conns[k];
+      // connection path never leaves the cluster it was built in
+      if (remap[conn.connIdx] == removedIdx ||
+          levelRemap.dirtyClusters[grid.cluster_of(conn.path.front().x, conn.path.front().y)])
+        continue;
+      conn.connIdx = remap[conn.connIdx];
+      keptConns[base.edgeOffsets[i] + k] = numConns;
+      if (numConns != k)
+        portal.conns[numConns] = std::move(conn);
+      ++numConns;
     }
-    curIdx = prevIdx;
+    portal.conns.resize(numConns);
+    keptPortals.push_back(std::move(portal));
   }
-  return res;
+  portals = std::move(keptPortals);
+  for (std::vector<size_t> &indices : tilePortalsIndices)
+  {
+    std::erase_if(indices, [&](size_t idx) { return remap[idx] == removedIdx; });
+    for (size_t &idx : indices)
+      idx = remap[idx];
+  }
+
+  // re-derive borders of changed clusters, each border is owned by the cluster below or to the right of it
+  for (size_t tidx = 0; tidx < numClusters; ++tidx)
+  {
+    size_t x = tidx % width;
+    size_t y = tidx / width;
+    if (y > 0 && (changedCluster[tidx] || changedCluster[tidx - width]))
+      build_border_portals(dd, *this, x, y, BORDER_TOP);
+    if (x > 0 && (changedCluster[tidx] || changedCluster[tidx - 1]))
+      build_border_portals(dd, *this, x, y, BORDER_LEFT);
+  }
+
+  std::vector<size_t> dirtyClusters;
+  for (size_t tidx = 0; tidx < numClusters; ++tidx)
+    if (levelRemap.dirtyClusters[tidx])
+      dirtyClusters.push_back(tidx);
+  connect_clusters(dd, *this, dirtyClusters, pool);
+  update_levels(dd, *this, levelRemap, keptConns, pool);
 }
 
-std::vector<IVec2> find_path_hierarchical(const DungeonData &dd, const DungeonPortals& dp, 
-                                    IVec2 from, IVec2 to)
+// Appends segment to the path, dropping its first point if it repeats the current end of the path
+static void append_segment(std::vector<IVec2> &res, const std::vector<IVec2> &segment)
 {
-  if (from.x < 0 || from.y < 0 || from.x >= int(dd.width) || from.y >= int(dd.height))
-    return std::vector<IVec2>();
+  auto begin = segment.begin();
+  if (!res.empty() && begin != segment.end() && *begin == res.back())
+    ++begin;
+  res.insert(res.end(), begin, segment.end());
+}
+
+// Link between start or goal and a portal of its cluster on some level.
+// On level 0 it's a grid path (leading from the portal to the goal for goal links),
+// on upper levels it continues lowerLink of the level below with edges of that level
+struct EndPointLink
+{
+  size_t portal;
+  float score;
+  IVec2 cell; // cell of the portal where link touches it
+  size_t lowerLink;
+  std::vector<size_t> edges;
+  std::vector<IVec2> path;
+};
 
+// Scratch state of abstract searches, nodes are portals followed by temporary goal node.
+// prev/prevLink/entry are written together with g, so they don't need resetting between searches
+struct PortalSearchContext
+{
+  SearchContext search;
+  std::vector<size_t> prev; // search starts from nodes which are their own prev
+  std::vector<size_t> prevLink; // edge (or end point link for start and goal) which led here
+  std::vector<IVec2> entry; // cell where portal was entered
+  std::vector<std::vector<EndPointLink>> fromLinks; // per level
+  std::vector<std::vector<EndPointLink>> toLinks;
+
+  void begin_search(size_t num_nodes)
   {
-    size_t fromTileX = from.x / splitTiles;
-    size_t fromTileY = from.y / splitTiles;
+    search.begin_search(num_nodes);
+    if (prev.size() < num_nodes)
+    {
+      prev.resize(num_nodes);
+      prevLink.resize(num_nodes);
+      entry.resize(num_nodes);
+    }
+  }
+
+  void begin_query(size_t num_levels)
+  {
+    fromLinks.resize(num_levels);
+    toLinks.resize(num_levels);
+    for (size_t level = 0; level < num_levels; ++level)
+    {
+      fromLinks[level].clear();
+      toLinks[level].clear();
+    }
+  }
+};
+
+static PortalSearchContext &get_portal_search_context()
+{
+  static thread_local PortalSearchContext ctx;
+  return ctx;
+}
+
+static IVec2 portal_center(const PathPortal &portal)
+{
+  return {int(portal.startX + portal.endX) / 2, int(portal.startY + portal.endY) / 2};
+}
+
+// Cost of walking inside of a portal along its span and then across it, entry is unknown for nodes search starts from.
+// All cells of a portal are walkable, so the walk never runs into walls
+static float portal_walk(const DungeonData &dd, IVec2 entry, IVec2 exit)
+{
+  if (entry.x < 0)
+    return 0.f;
+  float cost = 0.f;
+  for (IVec2 p = entry; p != exit;)
+  {
+    if (p.x != exit.x)
+      p.x += sign(exit.x - p.x);
+    else
+      p.y += sign(exit.y - p.y);
+    cost += float(dungeon::tile_cost(dd.tiles[coord_to_idx(p.x, p.y, dd.width)]));
+  }
+  return cost;
+}
+
+static void relax(PortalSearchContext &pctx, size_t from, size_t to, size_t link, float g, IVec2 enter, float h)
+{
+  SearchContext &search = pctx.search;
+  search.touch(to);
+  if (search.closed[to] || g >= search.g[to])
+    return;
+  search.g[to] = g;
+  pctx.prev[to] = from;
+  pctx.prevLink[to] = link;
+  pctx.entry[to] = enter;
+  search.openList.push(to, g + h);
+}
 
-    size_t toTileX = to.x / splitTiles;
-    size_t toTileY = to.y / splitTiles;
+// Appends edges leading to node from the node search started at, returns link that starting node was seeded with
+static size_t collect_chain(const PortalSearchContext &pctx, size_t node, std::vector<size_t> &edges)
+{
+  const size_t start = edges.size();
+  for (; pctx.prev[node] != node; node = pctx.prev[node])
+    edges.push_back(pctx.prevLink[node]);
+  std::reverse(edges.begin() + start, edges.end());
+  return pctx.prevLink[node];
+}
 
-    // In one big tile
-    if ((fromTileX == toTileX) && (fromTileY == toTileY))
+// Dijkstra from already seeded nodes over edges of the level which lie inside of cluster of the grid above it
+static void flood_level(const DungeonData &dd, const PortalLevel &level, const ClusterGrid &grid, size_t cluster,
+                        PortalSearchContext &pctx)
+{
+  SearchContext &search = pctx.search;
+  while (!search.openList.empty())
+  {
+    size_t curIdx = search.openList.pop();
+    search.closed[curIdx] = 1;
+    for (size_t e = level.edgeOffsets[curIdx]; e < level.edgeOffsets[curIdx + 1]; ++e)
     {
-      IVec2 limMin{int((fromTileX + 0) * splitTiles), int((fromTileY + 0) * splitTiles)};
-      IVec2 limMax{int((fromTileX + 1) * splitTiles), int((fromTileY + 1) * splitTiles)};
-      auto path = find_path_a_star(dd, from, to, limMin, limMax);
-      if (!path.empty() || from == to) 
-        return path;
+      const PortalEdge &edge = level.edges[e];
+      if (grid.cluster_of(edge.exit) != cluster)
+        continue;
+      relax(pctx, curIdx, edge.to, e, search.g[curIdx] + portal_walk(dd, pctx.entry[curIdx], edge.exit) + edge.score,
+            edge.enter, 0.f);
     }
   }
+}
 
-  // Build portals graph
-  std::vector<std::pair<float, float>> portalsPos;
-  for (auto& port : dp.portals) // we use center point of a portal
-    portalsPos.push_back(std::pair(float(port.startX + port.endX)/2., float(port.startY + port.endY)/2.));
-  
-  portalsPos.push_back({(float)from.x, (float)from.y});
-  portalsPos.push_back({(float)to.x, (float)to.y});
+struct UpperEdge
+{
+  size_t from;
+  PortalEdge edge;
+  std::vector<size_t> subEdges;
+};
 
-  std::vector<std::vector<float>> edges(portalsPos.size(), std::vector<float>(portalsPos.size(), -1.));
-  for (size_t i = 0; i < dp.portals.size(); i++) {
-    for (auto& conn : dp.portals[i].conns) {
-      edges[i][conn.connIdx] = conn.score;
+// Connects every pair of border portals of an upper level cluster through the level below it
+static void connect_upper_cluster(const DungeonData &dd, const DungeonPortals &dp, const PortalLevel &lower,
+                                  const ClusterGrid &grid, const std::vector<size_t> &nodes, size_t cluster,
+                                  PortalSearchContext &pctx, std::vector<UpperEdge> &edges)
+{
+  constexpr size_t noLink = std::numeric_limits<size_t>::max();
+  for (size_t from : nodes)
+  {
+    pctx.begin_search(dp.portals.size());
+    relax(pctx, from, from, noLink, 0.f, {-1, -1}, 0.f);
+    flood_level(dd, lower, grid, cluster, pctx);
+    for (size_t to : nodes)
+    {
+      if (to == from || pctx.search.get_g(to) == std::numeric_limits<float>::max())
+        continue;
+      UpperEdge ue{from, {}, {}};
+      collect_chain(pctx, to, ue.subEdges);
+      ue.edge = {to, pctx.search.g[to], lower.edges[ue.subEdges.front()].exit, pctx.entry[to]};
+      edges.push_back(std::move(ue));
     }
   }
+}
 
-  size_t fromIdx = dp.portals.size();
-  size_t toIdx = fromIdx + 1;
+// Connects border portals of every cluster of the level. With remap only clusters containing dirty level 0 clusters
+// are connected again, the rest keep their edges with indices remapped, edge_remap gets where old edges went
+static void build_upper_level(const DungeonData &dd, DungeonPortals &dp, size_t level, ThreadPool *pool,
+                              const LevelRemap *remap = nullptr, std::vector<size_t> *edge_remap = nullptr)
+{
+  const PortalLevel &lower = dp.levels[level - 1];
+  PortalLevel &upper = dp.levels[level];
+  const ClusterGrid grid(dd, upper.tileSplit);
 
-  std::vector<std::vector<IVec2>> fromConn(dp.portals.size());
-  std::vector<std::vector<IVec2>> toConn(dp.portals.size());
+  // only portals between two clusters of this level are its nodes
+  upper.clusterNodes.assign(grid.size(), {});
+  for (size_t i = 0; i < dp.portals.size(); ++i)
+  {
+    const PathPortal &portal = dp.portals[i];
+    size_t startCluster = grid.cluster_of(portal.startX, portal.startY);
+    size_t endCluster = grid.cluster_of(portal.endX, portal.endY);
+    if (startCluster == endCluster || startCluster >= grid.size() || endCluster >= grid.size())
+      continue;
+    upper.clusterNodes[startCluster].push_back(i);
+    upper.clusterNodes[endCluster].push_back(i);
+  }
 
-  auto fillConnections = [&dd, &dp, &edges, &portalsPos]
-    (IVec2 endPoint, size_t endPointIdx, std::vector<std::vector<IVec2>> &connections, bool transpose)
+  std::vector<std::vector<UpperEdge>> clusterEdges(grid.size());
+  std::vector<std::vector<size_t>> clusterOldEdges(grid.size()); // old index of every kept edge
+  std::vector<uint8_t> rebuild(grid.size(), 1);
+  if (remap)
   {
-    size_t x = endPoint.x / splitTiles;
-    size_t y = endPoint.y / splitTiles;
-    IVec2 limMin{int((x + 0) * splitTiles), int((y + 0) * splitTiles)};
-    IVec2 limMax{int((x + 1) * splitTiles), int((y + 1) * splitTiles)};
-    for(size_t i = 0; i < dp.portals.size(); i++) {
-      if (std::abs(portalsPos[endPointIdx].first - portalsPos[i].first) <= splitTiles &&
-          std::abs(portalsPos[endPointIdx].second - portalsPos[i].second) <= splitTiles) {
-        bool noPath = false;
-        std::vector<IVec2> optimalPath{};
-        for (size_t otherEndPointY = std::max(dp.portals[i].startY, size_t(limMin.y));
-             otherEndPointY <= std::min(dp.portals[i].endY, size_t(limMax.y - 1)) && !noPath;
-             otherEndPointY++)
+    // level clusters are whole level 0 clusters, so a clean one has all of its portals and edges below kept
+    std::fill(rebuild.begin(), rebuild.end(), 0);
+    const ClusterGrid baseGrid(dd, dp.tileSplit);
+    for (size_t tidx = 0; tidx < baseGrid.size(); ++tidx)
+      if (remap->dirtyClusters[tidx])
+      {
+        IVec2 limMin, limMax;
+        baseGrid.bounds(tidx, limMin, limMax);
+        rebuild[grid.cluster_of(limMin)] = 1;
+      }
+    for (size_t from = 0; from + 1 < upper.edgeOffsets.size(); ++from)
+      for (size_t e = upper.edgeOffsets[from]; e < upper.edgeOffsets[from + 1]; ++e)
+      {
+        const PortalEdge &edge = upper.edges[e];
+        const size_t cluster = grid.cluster_of(edge.exit);
+        if (rebuild[cluster])
+          continue;
+        UpperEdge ue{remap->portals[from], edge, {}};
+        ue.edge.to = remap->portals[edge.to];
+        bool kept = ue.from != removedIdx && ue.edge.to != removedIdx;
+        for (size_t i = upper.subOffsets[e]; i < upper.subOffsets[e + 1]; ++i)
         {
-          for (size_t otherEndPointX = std::max(dp.portals[i].startX, size_t(limMin.x));
-               otherEndPointX <= std::min(dp.portals[i].endX, size_t(limMax.x - 1)) && !noPath;
-               otherEndPointX++)
-          {
-            IVec2 otherEndPoint{int(otherEndPointX), int(otherEndPointY)};
-            std::vector<IVec2> path = transpose 
-              ? find_path_a_star(dd, otherEndPoint, endPoint, limMin, limMax)
-              : find_path_a_star(dd, endPoint, otherEndPoint, limMin, limMax);
-            if (path.empty() && endPoint != otherEndPoint)
-            {
-              noPath = true; // if we found that there's no path at all - we can break out
-              break;
-            }
-            if (optimalPath.empty() || path.size() < optimalPath.size()) {
-              optimalPath = path;
-            }
-          }
+          ue.subEdges.push_back(remap->lowerEdges[upper.subEdges[i]]);
+          kept &= ue.subEdges.back() != removedIdx;
         }
-        if (!optimalPath.empty()) {
-          if (transpose)
-            edges[i][endPointIdx] = float(optimalPath.size());  
-          else
-            edges[endPointIdx][i] = float(optimalPath.size());
+        if (!kept) // shouldn't happen, but the cluster can always be connected again
+        {
+          rebuild[cluster] = 1;
+          continue;
         }
-        connections[i] = optimalPath;
+        clusterEdges[cluster].push_back(std::move(ue));
+        clusterOldEdges[cluster].push_back(e);
       }
+  }
+
+  std::vector<size_t> rebuilt;
+  for (size_t cluster = 0; cluster < grid.size(); ++cluster)
+    if (rebuild[cluster])
+    {
+      clusterEdges[cluster].clear();
+      clusterOldEdges[cluster].clear();
+      rebuilt.push_back(cluster);
     }
+  auto connect = [&](size_t i)
+  {
+    const size_t cluster = rebuilt[i];
+    connect_upper_cluster(dd, dp, lower, grid, upper.clusterNodes[cluster], cluster, get_portal_search_context(),
+                          clusterEdges[cluster]);
+    clusterOldEdges[cluster].assign(clusterEdges[cluster].size(), removedIdx);
   };
+  if (pool)
+    pool->parallel_for(rebuilt.size(), connect);
+  else
+    for (size_t i = 0; i < rebuilt.size(); ++i)
+      connect(i);
 
-  fillConnections(from, fromIdx, fromConn, false);
-  fillConnections(to, toIdx, toConn, true);
-
-  auto getPath = [&](size_t startIdx, size_t endIdx) {
-    if (endIdx == toIdx) {
-      return toConn[startIdx];
-    }
-    else if (startIdx == fromIdx) {
-      return fromConn[endIdx];
-    }
-    else {
-      auto& allConnections = dp.portals[startIdx].conns;
-      return (*std::find_if(allConnections.begin(), allConnections.end(), [&](auto& conn){ return conn.connIdx == endIdx; })).path;
+  // lay edges out by source portal, keeping cluster order within each portal
+  if (edge_remap)
+    edge_remap->assign(upper.edges.size(), removedIdx);
+  upper.edgeOffsets.assign(dp.portals.size() + 1, 0);
+  for (const std::vector<UpperEdge> &edges : clusterEdges)
+    for (const UpperEdge &ue : edges)
+      ++upper.edgeOffsets[ue.from + 1];
+  for (size_t i = 0; i < dp.portals.size(); ++i)
+    upper.edgeOffsets[i + 1] += upper.edgeOffsets[i];
+  std::vector<const UpperEdge*> sorted(upper.edgeOffsets.back());
+  std::vector<size_t> cursor(upper.edgeOffsets.begin(), upper.edgeOffsets.end() - 1);
+  for (size_t cluster = 0; cluster < grid.size(); ++cluster)
+    for (size_t i = 0; i < clusterEdges[cluster].size(); ++i)
+    {
+      const UpperEdge &ue = clusterEdges[cluster][i];
+      if (edge_remap && clusterOldEdges[cluster][i] != removedIdx)
+        (*edge_remap)[clusterOldEdges[cluster][i]] = cursor[ue.from];
+      sorted[cursor[ue.from]++] = &ue;
     }
-  };
+  upper.edges.clear();
+  upper.subOffsets.clear();
+  upper.subEdges.clear();
+  for (const UpperEdge *ue : sorted)
+  {
+    upper.edges.push_back(ue->edge);
+    upper.subOffsets.push_back(upper.subEdges.size());
+    upper.subEdges.insert(upper.subEdges.end(), ue->subEdges.begin(), ue->subEdges.end());
+  }
+  upper.subOffsets.push_back(upper.subEdges.size());
+}
 
-  // Find path
-  std::vector<float> g(portalsPos.size(), FLT_MAX);
-  std::vector<float> f(portalsPos.size(), FLT_MAX);
-  std::vector<size_t> prev(portalsPos.size(), portalsPos.size());
+static void build_base_level(DungeonPortals &dp)
+{
+  PortalLevel &base = dp.levels.front();
+  base.edgeOffsets.assign(dp.portals.size() + 1, 0);
+  base.edges.clear();
+  for (size_t i = 0; i < dp.portals.size(); ++i)
+  {
+    base.edgeOffsets[i] = base.edges.size();
+    for (const PortalConnection &conn : dp.portals[i].conns)
+      base.edges.push_back({conn.connIdx, conn.score, conn.path.front(), conn.path.back()});
+  }
+  base.edgeOffsets[dp.portals.size()] = base.edges.size();
+}
 
-  auto portals_heuristic = [&](size_t from, size_t to) -> float
-  { 
-    return sqrtf(sqr(portalsPos[from].first - portalsPos[to].first) +  sqr(portalsPos[from].second - portalsPos[to].second)); 
-  };
+void DungeonPortals::build_levels(const DungeonData &dd, ThreadPool *pool)
+{
+  build_base_level(*this);
+  for (size_t level = 1; level < levels.size(); ++level)
+    build_upper_level(dd, *this, level, pool);
+}
 
-  g[fromIdx] = 0;
-  f[fromIdx] = portals_heuristic(fromIdx, toIdx);
+// Level 0 edges are laid out again, upper levels only connect clusters which contain dirty ones.
+// kept_conns tells where every old level 0 edge is among connections of its portal
+static void update_levels(const DungeonData &dd, DungeonPortals &dp, LevelRemap &remap,
+                          const std::vector<size_t> &kept_conns, ThreadPool *pool)
+{
+  const std::vector<size_t> oldOffsets = dp.levels.front().edgeOffsets;
+  build_base_level(dp);
+  if (dp.levels.size() == 1)
+    return;
+  const PortalLevel &base = dp.levels.front();
+  remap.lowerEdges.assign(kept_conns.size(), removedIdx);
+  for (size_t i = 0; i + 1 < oldOffsets.size(); ++i)
+    if (remap.portals[i] != removedIdx)
+      for (size_t e = oldOffsets[i]; e < oldOffsets[i + 1]; ++e)
+        if (kept_conns[e] != removedIdx)
+          remap.lowerEdges[e] = base.edgeOffsets[remap.portals[i]] + kept_conns[e];
+  std::vector<size_t> edgeRemap;
+  for (size_t level = 1; level < dp.levels.size(); ++level)
+  {
+    build_upper_level(dd, dp, level, pool, &remap, &edgeRemap);
+    std::swap(remap.lowerEdges, edgeRemap);
+  }
+}
+
+// Appends level 0 edges which edge e of given level consists of
+static void expand_edge(const DungeonPortals &dp, size_t level, size_t e, std::vector<size_t> &res)
+{
+  if (level == 0)
+  {
+    res.push_back(e);
+    return;
+  }
+  const PortalLevel &lvl = dp.levels[level];
+  for (size_t i = lvl.subOffsets[e]; i < lvl.subOffsets[e + 1]; ++i)
+    expand_edge(dp, level - 1, lvl.subEdges[i], res);
+}
+
+// Appends level 0 edges of the link and returns level 0 link it starts with
+static size_t expand_link(const DungeonPortals &dp, const std::vector<std::vector<EndPointLink>> &links,
+                          size_t level, size_t link, std::vector<size_t> &res)
+{
+  if (level == 0)
+    return link;
+  const EndPointLink &endLink = links[level][link];
+  const size_t base = expand_link(dp, links, level - 1, endLink.lowerLink, res);
+  for (size_t e : endLink.edges)
+    expand_edge(dp, level - 1, e, res);
+  return base;
+}
+
+constexpr size_t noConnection = std::numeric_limits<size_t>::max();
+
+// Portals connected inside of a cluster are connected both ways, so every connection has the opposite one
+// in the portal it leads to, built in the same cluster. Two portals on the same border share two clusters,
+// so connections are told apart by the cluster their paths lie in.
+// noConnection if it's missing, routes going through such connection can't be walked
+static size_t opposite_connection(const DungeonPortals &dp, size_t portal, size_t conn)
+{
+  const PortalConnection &forward = dp.portals[portal].conns[conn];
+  const std::vector<PortalConnection> &conns = dp.portals[forward.connIdx].conns;
+  const int split = int(dp.tileSplit);
+  for (size_t i = 0; i < conns.size(); ++i)
+    if (conns[i].connIdx == portal && conns[i].path.front().x / split == forward.path.front().x / split &&
+        conns[i].path.front().y / split == forward.path.front().y / split)
+      return i;
+  return noConnection;
+}
+
+// Refines route found on given level down to portal connections, empty if it can't be walked
+static std::vector<RouteStep> expand_route(const DungeonPortals &dp, const PortalSearchContext &pctx, size_t level,
+                                           size_t from_link, const std::vector<size_t> &edges, size_t to_link,
+                                           size_t &from_base, size_t &to_base)
+{
+  const PortalLevel &base = dp.levels.front();
+  std::vector<size_t> baseEdges;
+  from_base = expand_link(dp, pctx.fromLinks, level, from_link, baseEdges);
+  for (size_t e : edges)
+    expand_edge(dp, level, e, baseEdges);
+  std::vector<RouteStep> route = {{pctx.fromLinks[0][from_base].portal, 0}};
+  for (size_t e : baseEdges)
+  {
+    const size_t portal = route.back().portal;
+    route.push_back({base.edges[e].to, e - base.edgeOffsets[portal]});
+  }
+
+  // goal links were searched away from the goal, so they are walked backwards
+  std::vector<size_t> goalEdges;
+  to_base = expand_link(dp, pctx.toLinks, level, to_link, goalEdges);
+  std::vector<size_t> goalPortals = {pctx.toLinks[0][to_base].portal};
+  for (size_t e : goalEdges)
+    goalPortals.push_back(base.edges[e].to);
+  for (size_t i = goalEdges.size(); i-- > 0;)
+  {
+    const size_t portal = goalPortals[i];
+    const size_t conn = opposite_connection(dp, portal, goalEdges[i] - base.edgeOffsets[portal]);
+    if (conn == noConnection)
+      return std::vector<RouteStep>();
+    route.push_back({portal, conn});
+  }
+  return route;
+}
+
+static const EndPointLink *find_link(const std::vector<EndPointLink> &links, size_t portal)
+{
+  for (const EndPointLink &link : links)
+    if (link.portal == portal)
+      return &link;
+  return nullptr;
+}
+
+// Turns abstract route into the grid path, only walks inside of portals are searched
+static std::vector<IVec2> stitch_route(const DungeonData &dd, const DungeonPortals& dp, const std::vector<IVec2> &from_path,
+                                       const std::vector<RouteStep> &route, const std::vector<IVec2> &to_path)
+{
+  SearchContext &ctx = get_search_context();
+  std::vector<IVec2> res = from_path;
+  for (size_t i = 0; i < route.size(); ++i)
+  {
+    const PathPortal &portal = dp.portals[route[i].portal];
+    const std::vector<IVec2> &nextSegment = i + 1 < route.size() ? portal.conns[route[i + 1].conn].path : to_path;
+    // walk inside the portal from where we entered it to where next segment leaves it
+    IVec2 enter = res.back();
+    res.pop_back();
+    find_path_in_cluster(ctx, dd, dp, enter, nextSegment.front(),
+                         {int(portal.startX), int(portal.startY)},
+                         {int(portal.endX) + 1, int(portal.endY) + 1}, res);
+    append_segment(res, nextSegment);
+  }
+  return res;
+}
+
+static uint64_t cache_key(size_t from, size_t to)
+{
+  return (from << 32) | to;
+}
+
+// Links end point to border portals of its cluster on given level through its links on the level below
+static void link_end_point(const DungeonData &dd, const DungeonPortals &dp, size_t level, IVec2 end_point,
+                           PortalSearchContext &pctx, std::vector<std::vector<EndPointLink>> &links)
+{
+  const ClusterGrid grid(dd, dp.levels[level].tileSplit);
+  const size_t cluster = grid.cluster_of(end_point);
+  pctx.begin_search(dp.portals.size());
+  const std::vector<EndPointLink> &lowerLinks = links[level - 1];
+  for (size_t i = 0; i < lowerLinks.size(); ++i)
+    relax(pctx, lowerLinks[i].portal, lowerLinks[i].portal, i, lowerLinks[i].score, lowerLinks[i].cell, 0.f);
+  flood_level(dd, dp.levels[level - 1], grid, cluster, pctx);
+  for (size_t node : dp.levels[level].clusterNodes[cluster])
+  {
+    if (pctx.search.get_g(node) == std::numeric_limits<float>::max())
+      continue;
+    EndPointLink link{node, pctx.search.g[node], pctx.entry[node], 0, {}, {}};
+    link.lowerLink = collect_chain(pctx, node, link.edges);
+    links[level].push_back(std::move(link));
+  }
+}
 
-  std::vector<std::pair<size_t, IVec2>> openList = {{fromIdx, from}};
-  std::vector<size_t> closedList;
+// A* over edges of one level between start and goal links of that level
+static bool search_level(const DungeonData &dd, const DungeonPortals &dp, size_t level, IVec2 to,
+                         PortalSearchContext &pctx, size_t &from_link, std::vector<size_t> &edges, size_t &to_link)
+{
+  const size_t toIdx = dp.portals.size();
+  auto portals_heuristic = [&](size_t idx) -> float
+  {
+    return idx == toIdx ? 0.f : heuristic(portal_center(dp.portals[idx]), to);
+  };
 
-  while (!openList.empty())
+  pctx.begin_search(toIdx + 1);
+  const std::vector<EndPointLink> &fromLinks = pctx.fromLinks[level];
+  const std::vector<EndPointLink> &toLinks = pctx.toLinks[level];
+  for (size_t i = 0; i < fromLinks.size(); ++i)
+    relax(pctx, fromLinks[i].portal, fromLinks[i].portal, i, fromLinks[i].score, fromLinks[i].cell,
+          portals_heuristic(fromLinks[i].portal));
+
+  const PortalLevel &lvl = dp.levels[level];
+  SearchContext &search = pctx.search;
+  while (!search.openList.empty())
   {
-    size_t bestIdx = 0;
-    float bestScore = f[openList[0].first];
-    for (size_t i = 1; i < openList.size(); ++i)
+    size_t curIdx = search.openList.pop();
+    if (curIdx == toIdx)
     {
-      float score = f[openList[i].first];
-      if (score < bestScore)
-      {
-        bestIdx = i;
-        bestScore = score;
-      }
+      to_link = pctx.prevLink[toIdx];
+      from_link = collect_chain(pctx, pctx.prev[toIdx], edges);
+      return true;
     }
-    if (openList[bestIdx].first == toIdx)
-      return reconstruct_path_hierarchical(dd, dp, prev, fromIdx, fromConn, toIdx, toConn);
+    search.closed[curIdx] = 1;
+    const IVec2 curPos = pctx.entry[curIdx];
+    const float g = search.g[curIdx];
+    for (size_t e = lvl.edgeOffsets[curIdx]; e < lvl.edgeOffsets[curIdx + 1]; ++e)
+    {
+      const PortalEdge &edge = lvl.edges[e];
+      relax(pctx, curIdx, edge.to, e, g + portal_walk(dd, curPos, edge.exit) + edge.score, edge.enter,
+            portals_heuristic(edge.to));
+    }
+    for (size_t link = 0; link < toLinks.size(); ++link)
+      if (toLinks[link].portal == curIdx)
+        relax(pctx, curIdx, toIdx, link, g + portal_walk(dd, curPos, toLinks[link].cell) + toLinks[link].score,
+              to, 0.f);
+  }
+  return false;
+}
 
-    size_t curIdx = openList[bestIdx].first;
-    IVec2 curPos = openList[bestIdx].second;
-    openList.erase(openList.begin() + bestIdx);
-    if (std::find(closedList.begin(), closedList.end(), curIdx) != closedList.end())
-      continue;
+static std::vector<IVec2> search_path_hierarchical(const DungeonData &dd, const DungeonPortals& dp,
+                                                   IVec2 from, IVec2 to)
+{
+  const ClusterGrid baseGrid(dd, dp.tileSplit);
+  // In one big tile
+  if (baseGrid.cluster_of(from) == baseGrid.cluster_of(to))
+  {
+    IVec2 limMin, limMax;
+    baseGrid.bounds(baseGrid.cluster_of(from), limMin, limMax);
+    std::vector<IVec2> path;
+    find_path_in_cluster(get_search_context(), dd, dp, from, to, limMin, limMax, path);
+    if (!path.empty() || from == to)
+      return path;
+  }
 
-    closedList.emplace_back(curIdx);
-    auto checkNeighbour = [&](size_t idx)
+  PortalSearchContext &pctx = get_portal_search_context();
+  pctx.begin_query(dp.levels.size());
+
+  SearchContext &ctx = get_search_context();
+  auto fillConnections = [&](IVec2 endPoint, std::vector<EndPointLink> &links, bool transpose)
+  {
+    const size_t cluster = baseGrid.cluster_of(endPoint);
+    IVec2 limMin, limMax;
+    baseGrid.bounds(cluster, limMin, limMax);
+    // links of the goal are walked towards it, so they are flooded paying for tiles being left
+    flood_from_span(ctx, dd, endPoint, endPoint, limMin, limMax, transpose);
+    for (size_t i : dp.tilePortalsIndices[cluster])
     {
-      auto path = getPath(curIdx, idx);
-      float edgeWeight = 0.f;
-      if (curIdx < dp.portals.size()) // Moving within portal
-        edgeWeight = float(std::abs(path.front().x - curPos.x) + std::abs(path.front().y - curPos.y));
-      
-      float gScore = g[curIdx] + edges[curIdx][idx] + edgeWeight;
-      bool better = gScore < g[idx];
-      if (better)
-      {
-        prev[idx] = curIdx;
-        g[idx] = gScore;
-        f[idx] = gScore + portals_heuristic(idx, toIdx);
-      }
-      bool found = std::find_if(openList.begin(), openList.end(), [&](auto val){ return val.first == idx; }) != openList.end();
-      if (!found || better)
-        openList.emplace_back(idx, path.back());
-    };
-    for(size_t j = 0; j < edges[curIdx].size(); j++) {
-      if (edges[curIdx][j] != -1)
-        checkNeighbour(j);
+      IVec2 spanMin, spanMax, target;
+      clip_portal(dp.portals[i], limMin, limMax, spanMin, spanMax);
+      if (!find_closest_cell(ctx, dd, spanMin, spanMax, target))
+        continue;
+      links.push_back({i, 0.f, target, 0, {}, {}});
+      std::vector<IVec2> &path = links.back().path;
+      reconstruct_path(ctx, target, dd.width, path);
+      if (transpose)
+        std::reverse(path.begin(), path.end());
+      links.back().score = ctx.g[coord_to_idx(target.x, target.y, dd.width)];
     }
+  };
+
+  fillConnections(from, pctx.fromLinks[0], false);
+  fillConnections(to, pctx.toLinks[0], true);
+  if (pctx.fromLinks[0].empty() || pctx.toLinks[0].empty())
+    return std::vector<IVec2>();
+
+  // Route found for another pair of cells in the same clusters only needs new ends
+  const uint64_t routeKey = cache_key(baseGrid.cluster_of(from), baseGrid.cluster_of(to));
+  if (const std::vector<RouteStep> *route = dp.cache.routes.find(routeKey))
+  {
+    const EndPointLink *fromLink = find_link(pctx.fromLinks[0], route->front().portal);
+    const EndPointLink *toLink = find_link(pctx.toLinks[0], route->back().portal);
+    if (fromLink && toLink)
+      return stitch_route(dd, dp, fromLink->path, *route, toLink->path);
+  }
+
+  // Search on the highest level where end points are in different clusters,
+  // so long paths only go through the few portals on borders of the biggest clusters
+  size_t topLevel = 0;
+  for (size_t level = 1; level < dp.levels.size(); ++level)
+  {
+    const ClusterGrid grid(dd, dp.levels[level].tileSplit);
+    const size_t fromCluster = grid.cluster_of(from);
+    const size_t toCluster = grid.cluster_of(to);
+    if (fromCluster >= grid.size() || toCluster >= grid.size() || fromCluster == toCluster)
+      break;
+    link_end_point(dd, dp, level, from, pctx, pctx.fromLinks);
+    link_end_point(dd, dp, level, to, pctx, pctx.toLinks);
+    if (pctx.fromLinks[level].empty() || pctx.toLinks[level].empty())
+      break;
+    topLevel = level;
+  }
+
+  // Refine found route top down, falling back to lower levels
+  // when end points can't reach each other through borders of their upper clusters or the route can't be walked
+  std::vector<size_t> edges;
+  for (size_t level = topLevel + 1; level-- > 0;)
+  {
+    size_t fromLink, toLink;
+    edges.clear();
+    if (!search_level(dd, dp, level, to, pctx, fromLink, edges, toLink))
+      continue;
+    size_t fromBase, toBase;
+    std::vector<RouteStep> route = expand_route(dp, pctx, level, fromLink, edges, toLink, fromBase, toBase);
+    if (route.empty())
+      continue;
+    return stitch_route(dd, dp, pctx.fromLinks[0][fromBase].path, dp.cache.routes.insert(routeKey, std::move(route)),
+                        pctx.toLinks[0][toBase].path);
   }
   // Return empty path if path not found
   return std::vector<IVec2>();
 }
+
+std::vector<IVec2> find_path_hierarchical(const DungeonData &dd, const DungeonPortals& dp,
+                                    IVec2 from, IVec2 to)
+{
+  if (from.x < 0 || from.y < 0 || from.x >= int(dd.width) || from.y >= int(dd.height))
+    return std::vector<IVec2>();
+  if (to.x < 0 || to.y < 0 || to.x >= int(dd.width) || to.y >= int(dd.height) ||
+      !dungeon::is_passable(dd.tiles[coord_to_idx(to.x, to.y, dd.width)]))
+    return std::vector<IVec2>();
+
+  PathCache &cache = dp.cache;
+  if (cache.version != dp.version)
+  {
+    cache.paths.clear();
+    cache.routes.clear();
+    cache.version = dp.version;
+  }
+  const uint64_t pathKey = cache_key(coord_to_idx(from.x, from.y, dd.width), coord_to_idx(to.x, to.y, dd.width));
+  if (const std::vector<IVec2> *path = cache.paths.find(pathKey))
+    return *path;
+  return cache.paths.insert(pathKey, search_path_hierarchical(dd, dp, from, to));
+}
@@ -1,13 +1,19 @@
 #pragma once
 #include <flecs.h>
 #include <vector>
+#include <limits>
+#include <algorithm>
+#include <cstdint>
 #include "math.h"
 #include "ecsTypes.h"
+#include "indexedHeap.h"
+#include "threadPool.h"
+#include "lruCache.h"
 
 struct PortalConnection
 {
   size_t connIdx;
-  float score;
+  float score; // summed costs of tiles path steps onto
   std::vector<IVec2> path;
 };
 
@@ -18,13 +24,131 @@ struct PathPortal
   std::vector<PortalConnection> conns;
 };
 
+struct PortalEdge
+{
+  size_t to;
+  float score;
+  IVec2 exit; // cell where edge leaves its source portal
+  IVec2 enter; // cell where edge enters its target portal
+};
+
+// One level of the abstract graph over portals. Level 0 edges are portal connections, edges of upper
+// levels join portals lying on borders of bigger clusters and are made of edges of the level below
+struct PortalLevel
+{
+  size_t tileSplit;
+  // edges of portal i are edges[edgeOffsets[i]..edgeOffsets[i + 1]), on level 0 in the same order as portals[i].conns
+  std::vector<size_t> edgeOffsets;
+  std::vector<PortalEdge> edges;
+  // edge e consists of edges subEdges[subOffsets[e]..subOffsets[e + 1]) of the level below (upper levels only)
+  std::vector<size_t> subOffsets;
+  std::vector<size_t> subEdges;
+  std::vector<std::vector<size_t>> clusterNodes; // portals on borders of each cluster (upper levels only)
+};
+
+// Portals visited by a hierarchical path in order, conn is the index of connection
+// in previous portal's conns which led to this one (unused for the first portal)
+struct RouteStep
+{
+  size_t portal;
+  size_t conn;
+};
+
+// Results of recent hierarchical queries, valid only while DungeonPortals::version doesn't change
+struct PathCache
+{
+  uint32_t version = 0;
+  LruCache<std::vector<IVec2>> paths{256}; // keyed on start and goal cells
+  LruCache<std::vector<RouteStep>> routes{64}; // keyed on start and goal clusters
+};
+
+// Grid search used for paths inside of clusters
+enum class GridSearch
+{
+  AStar,
+  JumpPoint
+};
+
 struct DungeonPortals
 {
   size_t tileSplit;
+  GridSearch gridSearch = GridSearch::AStar;
+  uint32_t version = 0; // bumped every time portals change
+  // Filled by find_path_hierarchical, queries sharing the same portals aren't thread safe
+  mutable PathCache cache;
   std::vector<PathPortal> portals;
   std::vector<std::vector<size_t>> tilePortalsIndices;
+  std::vector<PortalLevel> levels; // each level's clusters are several times bigger than ones of the level below
+
+  // Rebuilds edges of all levels from portal connections
+  void build_levels(const DungeonData &dd, ThreadPool *pool = nullptr);
+
+  // Re-derives portals on borders of clusters containing changed tiles and
+  // recomputes connections only inside of those clusters and their neighbours,
+  // upper levels only reconnect clusters containing those
+  void update_tiles(const DungeonData &dd, const std::vector<IVec2> &changed_tiles, ThreadPool *pool = nullptr);
 };
 
-void prebuild_map(flecs::world &ecs);
+// Scratch buffers for grid searches, reused between queries.
+// Instead of refilling the whole map-sized arrays every search, each cell stores
+// generation it was last written in and is reset lazily on first access.
+struct SearchContext
+{
+  std::vector<float> g;
+  std::vector<IVec2> prev;
+  std::vector<uint8_t> closed;
+  std::vector<uint32_t> generation;
+  uint32_t curGeneration = 0;
+  IndexedHeap<float> openList;
+  size_t expanded = 0; // nodes taken out of open list during the last search
+
+  void begin_search(size_t num_nodes)
+  {
+    expanded = 0;
+    if (generation.size() < num_nodes)
+    {
+      g.resize(num_nodes);
+      prev.resize(num_nodes);
+      closed.resize(num_nodes);
+      generation.resize(num_nodes, curGeneration);
+    }
+    openList.clear();
+    openList.reserve_nodes(num_nodes);
+    if (++curGeneration == 0) // wrapped around, old marks can't be trusted anymore
+    {
+      std::fill(generation.begin(), generation.end(), 0);
+      curGeneration = 1;
+    }
+  }
+
+  float get_g(size_t idx) const
+  {
+    return generation[idx] == curGeneration ? g[idx] : std::numeric_limits<float>::max();
+  }
+
+  void touch(size_t idx)
+  {
+    if (generation[idx] == curGeneration)
+      return;
+    generation[idx] = curGeneration;
+    g[idx] = std::numeric_limits<float>::max();
+    prev[idx] = {-1, -1};
+    closed[idx] = 0;
+  }
+};
+
+// Searches paths inside of [lim_min, lim_max) over 4-connected grid, found path is appended to `path`
+bool find_path_a_star(SearchContext &ctx, const DungeonData &dd, IVec2 from, IVec2 to,
+                      IVec2 lim_min, IVec2 lim_max, std::vector<IVec2> &path);
+// Jump point search, finds paths of the same cost as A* while opening only cells where paths can turn or get costlier
+bool find_path_jps(SearchContext &ctx, const DungeonData &dd, IVec2 from, IVec2 to,
+                   IVec2 lim_min, IVec2 lim_max, std::vector<IVec2> &path);
+
+// Clusters are connected in parallel if pool is provided.
+// split_tiles doesn't have to divide map size, clusters on the right and bottom edges are cut short then.
+// grid_search is used by queries for paths inside of clusters.
+// num_levels of abstract graph, each level's clusters are 4x4 clusters of the level below
+void prebuild_map(flecs::world &ecs, ThreadPool *pool = nullptr, size_t split_tiles = 10,
+                  GridSearch grid_search = GridSearch::AStar, size_t num_levels = 1);
 
 std::vector<IVec2> find_path_hierarchical(const DungeonData &dd, const DungeonPortals& dp, IVec2 from, IVec2 to);
\ No newline at end of file
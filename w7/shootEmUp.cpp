@@ -27,6 +27,21 @@ static void draw_path(std::vector<IVec2> path)
   }
 }
 
+static void set_tile_texture(flecs::world &ecs, IVec2 tile, char tile_type)
+{
+  static auto backgroundTilesQuery = ecs.query<const Position, const BackgroundTile>();
+  flecs::entity textureSrc = ecs.entity(tile_type == dungeon::wall ? "wall_tex" : "floor_tex");
+  const float tileX = float(tile.x) * tile_size;
+  const float tileY = float(tile.y) * tile_size;
+  backgroundTilesQuery.each([&](flecs::entity e, const Position &pos, const BackgroundTile)
+  {
+    if (pos.x != tileX || pos.y != tileY)
+      return;
+    e.remove<TextureSource>(flecs::Wildcard);
+    e.add<TextureSource>(textureSrc);
+  });
+}
+
 static void register_roguelike_systems(flecs::world &ecs)
 {
   static auto playerPosQuery = ecs.query<const Position, const IsPlayer>();
@@ -101,26 +116,28 @@ static void register_roguelike_systems(flecs::world &ecs)
   static IVec2 hovered = {-1, -1};
 
   static auto cameraQuery = ecs.query<const Camera2D>();
-  ecs.system<const DungeonPortals, const DungeonData>()
-    .each([&](const DungeonPortals &dp, const DungeonData &dd)
+  ecs.system<DungeonPortals, DungeonData>()
+    .each([&](DungeonPortals &dp, DungeonData &dd)
     {
       size_t w = dd.width;
       size_t ts = dp.tileSplit;
-      for (size_t y = 0; y < dd.height / ts; ++y)
+      // clusters on the right and bottom edges may be cut short
+      size_t wd = (w + ts - 1) / ts;
+      size_t ht = (dd.height + ts - 1) / ts;
+      for (size_t y = 0; y < ht; ++y)
         DrawLineEx(Vector2{0.f, y * ts * tile_size},
                    Vector2{dd.width * tile_size, y * ts * tile_size}, 1.f, GetColor(0xff000080));
-      for (size_t x = 0; x < dd.width / ts; ++x)
+      for (size_t x = 0; x < wd; ++x)
         DrawLineEx(Vector2{x * ts * tile_size, 0.f},
                    Vector2{x * ts * tile_size, dd.height * tile_size}, 1.f, GetColor(0xff000080));
       cameraQuery.each([&](Camera2D cam)
       {
         Vector2 mousePosition = GetScreenToWorld2D(GetMousePosition(), cam);
-        size_t wd = w / ts;
-        for (size_t y = 0; y < dd.height / ts; ++y)
+        for (size_t y = 0; y < ht; ++y)
         {
           if (mousePosition.y < y * ts * tile_size || mousePosition.y > (y + 1) * ts * tile_size)
             continue;
-          for (size_t x = 0; x < dd.width / ts; ++x)
+          for (size_t x = 0; x < wd; ++x)
           {
             if (mousePosition.x < x * ts * tile_size || mousePosition.x > (x + 1) * ts * tile_size)
               continue;
@@ -163,6 +180,15 @@ static void register_roguelike_systems(flecs::world &ecs)
           from = hovered;
         else if (IsMouseButtonPressed(1))
           to = hovered;
+        else if (IsMouseButtonPressed(2) && hovered.x >= 0 && hovered.y >= 0 &&
+                 hovered.x < int(dd.width) && hovered.y < int(dd.height))
+        {
+          // dig or build a wall, portals are rebuilt only around the changed tile
+          char &tile = dd.tiles[hovered.y * dd.width + hovered.x];
+          tile = tile == dungeon::wall ? dungeon::floor : dungeon::wall;
+          dp.update_tiles(dd, {hovered});
+          set_tile_texture(ecs, hovered, tile);
+        }
 
         draw_path(find_path_hierarchical(dd, dp, from, to));
 
@@ -228,7 +254,8 @@ void init_dungeon(flecs::world &ecs, char *tiles, size_t w, size_t h)
       else if (tile == dungeon::floor)
         tileEntity.add<TextureSource>(floorTex);
     }
-  prebuild_map(ecs);
+  ThreadPool pool;
+  prebuild_map(ecs, &pool);
 }
 
 void process_game(flecs::world &ecs)
@@ -0,0 +1,102 @@
+#include "threadPool.h"
+#include <algorithm>
+
+ThreadPool::ThreadPool(size_t num_threads) : workers(num_threads > 0 ? num_threads : 1)
+{
+  for (size_t i = 1; i < workers.size(); ++i)
+    threads.emplace_back([this, i]() { worker_loop(i); });
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(batchMutex);
+    stop = true;
+  }
+  batchCv.notify_all();
+  for (std::thread &thread : threads)
+    thread.join();
+}
+
+void ThreadPool::parallel_for(size_t count, const std::function<void(size_t)> &in_job)
+{
+  if (count == 0)
+    return;
+  job = &in_job;
+  remaining = count;
+  // contiguous chunks keep neighbouring tasks on the same worker until stealing kicks in
+  const size_t chunk = (count + workers.size() - 1) / workers.size();
+  for (size_t i = 0; i < workers.size(); ++i)
+  {
+    std::lock_guard<std::mutex> lock(workers[i].mutex);
+    for (size_t task = i * chunk; task < std::min(count, (i + 1) * chunk); ++task)
+      workers[i].tasks.push_back(task);
+  }
+  {
+    std::lock_guard<std::mutex> lock(batchMutex);
+    batch++;
+  }
+  batchCv.notify_all();
+
+  run_tasks(0);
+
+  std::unique_lock<std::mutex> lock(batchMutex);
+  doneCv.wait(lock, [this]() { return remaining == 0; });
+  job = nullptr;
+}
+
+void ThreadPool::worker_loop(size_t worker_idx)
+{
+  size_t seenBatch = 0;
+  while (true)
+  {
+    {
+      std::unique_lock<std::mutex> lock(batchMutex);
+      batchCv.wait(lock, [&]() { return stop || batch != seenBatch; });
+      if (stop)
+        return;
+      seenBatch = batch;
+    }
+    run_tasks(worker_idx);
+  }
+}
+
+void ThreadPool::run_tasks(size_t worker_idx)
+{
+  size_t task = 0;
+  while (pop_task(worker_idx, task))
+  {
+    (*job)(task);
+    if (remaining.fetch_sub(1) == 1)
+    {
+      std::lock_guard<std::mutex> lock(batchMutex);
+      doneCv.notify_all();
+    }
+  }
+}
+
+bool ThreadPool::pop_task(size_t worker_idx, size_t &task)
+{
+  {
+    Worker &own = workers[worker_idx];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    if (!own.tasks.empty())
+    {
+      task = own.tasks.front();
+      own.tasks.pop_front();
+      return true;
+    }
+  }
+  for (size_t i = 1; i < workers.size(); ++i)
+  {
+    Worker &victim = workers[(worker_idx + i) % workers.size()];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if (!victim.tasks.empty())
+    {
+      task = victim.tasks.back();
+      victim.tasks.pop_back();
+      return true;
+    }
+  }
+  return false;
+}